@@ -1,7 +1,14 @@
 #include "driver/context.h"
 #include "gi/algorithm.h"
+#include "gi/lightcuts.h"
 #include "gi/bdpt.h"
 #include "gi/rng.h"
+#include "gi/color.h"
+#include "gi/timer.h"
+#include "gi/sampling.h"
+#include "gi/scene.h"
+#include "gi/ray.h"
+#include <iostream>
 
 using namespace std;
 using namespace glm;
@@ -10,18 +17,142 @@ struct ManyLights : public Algorithm {
     inline static const std::string name = "ManyLights";
 
     // ManyLights parameters: trade quality for performance here
-    const uint32_t NUM_VPL_PATHS = 1 << 14;
-    const uint32_t VPL_PATHS_PER_SAMPLE = 4;
+    uint32_t NUM_VPL_PATHS = 1 << 14;
+    bool LIGHTCUTS = true;              ///< Evaluate VPLs via lightcuts instead of gathering all of them
+    float LIGHTCUTS_ERROR = 0.02f;      ///< Maximum relative error per cluster
+    uint32_t LIGHTCUTS_MAX_CUT = 1000;  ///< Maximum cut size
+    float VPL_CLAMP = 1e-2f;            ///< Minimum distance for the VPL geometry term, relative to the scene radius
+    uint32_t VPL_MAX_BOUNCES = 4;       ///< Maximum number of diffuse bounces per light path
+    bool BENCHMARK = false;             ///< Compare lightcuts against gathering all VPLs for one frame in init()
+
+    // data
+    std::shared_ptr<VPLTree> tree;
+
+    void read_config(const json11::Json& cfg) {
+        json_set_uint(cfg, "vpl_paths", NUM_VPL_PATHS);
+        json_set_bool(cfg, "lightcuts", LIGHTCUTS);
+        json_set_float(cfg, "lightcuts_error", LIGHTCUTS_ERROR);
+        json_set_uint(cfg, "lightcuts_max_cut", LIGHTCUTS_MAX_CUT);
+        json_set_float(cfg, "vpl_clamp", VPL_CLAMP);
+        json_set_uint(cfg, "vpl_max_bounces", VPL_MAX_BOUNCES);
+        json_set_bool(cfg, "lightcuts_benchmark", BENCHMARK);
+    }
 
     // called once before each(!) rendering
     void init(Context& context) {
-        throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+        // trace light paths, each path vertex is a VPL
+        std::vector<PathVertex> vertices;
+        #pragma omp parallel
+        {
+            std::vector<PathVertex> local, path;
+            #pragma omp for
+            for (int i = 0; i < int(NUM_VPL_PATHS); ++i) {
+                path.clear();
+                // stratify light selection over all paths, independent of how the loop is split among threads
+                const float sample_light = fminf((i + RNG::uniform<float>()) / NUM_VPL_PATHS, 0x1.fffffep-1f);
+                trace_vpl_path(context, path, sample_light);
+                for (const PathVertex& v : path)
+                    local.emplace_back(v, 1.f / NUM_VPL_PATHS);
+            }
+            #pragma omp critical
+            vertices.insert(vertices.end(), local.begin(), local.end());
+        }
+        tree = std::make_shared<VPLTree>(vertices, VPL_CLAMP * context.scene.radius);
+        if (BENCHMARK) benchmark(context);
+    }
+
+    // light path from a point on a (finite) light source with diffuse bounces, the VPLs are diffuse emitters/reflectors
+    void trace_vpl_path(const Context& context, std::vector<PathVertex>& path, float sample_light) const {
+        const Scene& scene = context.scene;
+        const auto [light, p_select] = scene.sample_light_source(sample_light);
+        const glm::vec2 sample_pos = RNG::uniform<glm::vec2>(), sample_dir = RNG::uniform<glm::vec2>();
+        if (!light || p_select <= 0.f || light->is_infinite()) return; // lightcuts only cluster finite VPLs
+        const auto [pos, N, Le, pdf_pos] = light->sample_point(sample_pos);
+        if (pdf_pos <= 0.f || luma(Le) <= 0.f) return;
+        const SurfaceInteraction on_light(pos, N);
+        path.emplace_back(on_light, Le / (p_select * pdf_pos), p_select * pdf_pos);
+        // cosine distributed emission, then diffuse bounces with russian roulette
+        vec3 throughput = Le * PI / (p_select * pdf_pos);
+        Ray ray = on_light.spawn_ray(cosine_direction(N, sample_dir));
+        for (uint32_t depth = 0; depth < VPL_MAX_BOUNCES; ++depth) {
+            const SurfaceInteraction hit = scene.intersect(ray);
+            if (!hit.valid || hit.is_light()) return;
+            path.emplace_back(hit, -ray.dir, throughput, 1.f);
+            const vec3 albedo = hit.albedo();
+            const float p_continue = fminf(1.f, luma(albedo));
+            if (p_continue <= 0.f || RNG::uniform<float>() >= p_continue) return;
+            throughput *= albedo / p_continue;
+            const vec3 N_hit = dot(hit.N, ray.dir) < 0.f ? hit.N : -hit.N;
+            ray = hit.spawn_ray(cosine_direction(N_hit, RNG::uniform<glm::vec2>()));
+        }
+    }
+
+    // cosine distributed direction around N (Malley's method)
+    inline static vec3 cosine_direction(const vec3& N, const vec2& sample) {
+        const vec2 d = concentric_sample_disk(sample);
+        return align(N, vec3(d, sqrtf(fmaxf(0.f, 1.f - dot(d, d)))));
     }
 
     void sample_pixel(Context& context, uint32_t x, uint32_t y, uint32_t samples) {
-        throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+        const size_t w = context.fbo.width(), h = context.fbo.height();
+        UniformSampler2D pixel_sampler, lens_sampler;
+        pixel_sampler.init(samples);
+        lens_sampler.init(samples);
+        for (uint32_t i = 0; i < samples; ++i) {
+            RayDifferential diff;
+            Ray ray = context.cam.view_ray(x, y, w, h, diff, pixel_sampler.next(), lens_sampler.next());
+            context.fbo.add_sample(x, y, shade(context, ray, diff));
+        }
     }
 
+    vec3 shade(Context& context, Ray& ray, const RayDifferential& diff) const {
+        const SurfaceInteraction hit = context.scene.intersect(ray, diff);
+        if (!hit.valid) return context.scene.Le(ray, diff.spread());
+        if (hit.is_light()) return hit.Le();
+        if (!LIGHTCUTS) return tree->shade_brute_force(context.scene, hit, -ray.dir);
+        const auto [L, cut_size] = tree->shade(context.scene, hit, -ray.dir, LIGHTCUTS_ERROR, LIGHTCUTS_MAX_CUT);
+        return L;
+    }
+
+    // time one frame (one primary ray per pixel) with lightcuts and with gathering all VPLs
+    void benchmark(Context& context) const {
+        const uint32_t w = context.fbo.width(), h = context.fbo.height();
+        std::vector<vec3> reference(size_t(w) * h, vec3(0)), approx(size_t(w) * h, vec3(0));
+        uint64_t cut_sizes = 0, shaded = 0;
+        Timer timer;
+        timer.start("brute force");
+        #pragma omp parallel for schedule(dynamic)
+        for (int y = 0; y < int(h); ++y) {
+            for (uint32_t x = 0; x < w; ++x) {
+                Ray ray = context.cam.view_ray(x, y, w, h);
+                const SurfaceInteraction hit = context.scene.intersect(ray);
+                if (hit.valid && !hit.is_light())
+                    reference[size_t(y) * w + x] = tree->shade_brute_force(context.scene, hit, -ray.dir);
+            }
+        }
+        timer.stop("brute force");
+        timer.start("lightcuts");
+        #pragma omp parallel for schedule(dynamic) reduction(+ : cut_sizes, shaded)
+        for (int y = 0; y < int(h); ++y) {
+            for (uint32_t x = 0; x < w; ++x) {
+                Ray ray = context.cam.view_ray(x, y, w, h);
+                const SurfaceInteraction hit = context.scene.intersect(ray);
+                if (hit.valid && !hit.is_light()) {
+                    const auto [L, cut_size] = tree->shade(context.scene, hit, -ray.dir, LIGHTCUTS_ERROR, LIGHTCUTS_MAX_CUT);
+                    approx[size_t(y) * w + x] = L;
+                    cut_sizes += cut_size;
+                    shaded += 1;
+                }
+            }
+        }
+        timer.stop("lightcuts");
+        double rel_error = 0;
+        for (size_t i = 0; i < reference.size(); ++i)
+            rel_error += luma(abs(approx[i] - reference[i])) / fmaxf(1e-5f, luma(reference[i]));
+        std::cout << "ManyLights benchmark (" << tree->size() << " VPLs, " << w << "x" << h << "): brute force: "
+            << timer.get_ms("brute force") << "ms/frame, lightcuts: " << timer.get_ms("lightcuts") << "ms/frame, avg cut size: "
+            << cut_sizes / double(std::max<uint64_t>(1, shaded)) << ", avg rel error: " << rel_error / reference.size() << std::endl;
+    }
 };
 
 static AlgorithmRegistrar<ManyLights> registrar;
@@ -0,0 +1,234 @@
+#include "driver/context.h"
+#include "gi/algorithm.h"
+#include "gi/surface.h"
+#include "gi/scene.h"
+#include "gi/random.h"
+#include "gi/light.h"
+#include "gi/color.h"
+#include "gi/packing.h"
+#include "gi/ray.h"
+#include "gi/rng.h"
+#include <unordered_map>
+
+using namespace std;
+using namespace glm;
+
+/**
+ * @brief Direct illumination via reservoir-based spatiotemporal importance resampling (ReSTIR, Bitterli et al. 2020)
+ * @note Each pixel resamples many unshadowed light candidates into a reservoir, combines it with its own reservoir
+ * from previous passes (temporal) and with reservoirs of nearby pixels from the previous pass (spatial), then traces
+ * a single shadow ray. Reservoirs are combined with the biased 1/M weighting. Reuse assumes a static camera
+ * across passes, which holds since any change restarts rendering. Shading is diffuse (albedo / pi).
+ */
+struct ReSTIR : public Algorithm {
+    inline static const std::string name = "ReSTIR";
+
+    // ReSTIR parameters: trade quality for performance here
+    uint32_t NUM_CANDIDATES = 32;       ///< Unshadowed light candidates per pixel and pass
+    uint32_t SPATIAL_NEIGHBORS = 4;     ///< Neighbouring reservoirs to combine per pixel and pass
+    float SPATIAL_RADIUS = 20.f;        ///< Radius for selecting neighbours in pixels
+    uint32_t TEMPORAL_MAX_M = 20;       ///< Cap of the temporal history, relative to NUM_CANDIDATES
+
+    static constexpr uint32_t TILE = 8; ///< Reservoirs are stored in tiles of TILE x TILE pixels
+
+    struct Reservoir {
+        glm::vec3 y;        ///< Sampled point on the light source (direction for infinite light sources)
+        uint32_t N;         ///< Light source normal at y (octahedral)
+        glm::vec3 Le;       ///< Emitted radiance at y
+        uint32_t light;     ///< Index into Scene::lights
+        float w_sum;        ///< Sum of resampling weights
+        float W;            ///< Unbiased contribution weight of y
+        uint32_t M;         ///< Number of candidates seen
+    };
+    static_assert(sizeof(Reservoir) == 44, "Reservoir layout changed");
+
+    struct Surface {
+        float depth;        ///< Distance to the camera, < 0 if no valid surface
+        uint32_t N;         ///< Shading normal (octahedral)
+    };
+
+    // data
+    uint32_t w = 0, h = 0, tiles_w = 0;
+    std::vector<Reservoir> temporal;        ///< Latest reservoir per pixel, only touched by the pixel itself
+    std::vector<Surface> surfaces;          ///< Latest shading point per pixel
+    std::vector<Reservoir> spatial;         ///< Snapshot of the previous pass, read by neighbours
+    std::vector<Surface> spatial_surfaces;  ///< Snapshot of the previous pass, read by neighbours
+    std::unordered_map<const Light*, uint32_t> light_index;
+
+    void read_config(const json11::Json& cfg) {
+        json_set_uint(cfg, "restir_candidates", NUM_CANDIDATES);
+        json_set_uint(cfg, "restir_spatial_neighbors", SPATIAL_NEIGHBORS);
+        json_set_float(cfg, "restir_spatial_radius", SPATIAL_RADIUS);
+        json_set_uint(cfg, "restir_temporal_max_m", TEMPORAL_MAX_M);
+    }
+
+    // called once before each(!) rendering
+    void init(Context& context) {
+        w = context.fbo.width();
+        h = context.fbo.height();
+        tiles_w = (w + TILE - 1) / TILE;
+        const size_t n = size_t(tiles_w) * ((h + TILE - 1) / TILE) * TILE * TILE;
+        temporal.assign(n, Reservoir{ glm::vec3(0), 0, glm::vec3(0), 0, 0.f, 0.f, 0 });
+        surfaces.assign(n, Surface{ -1.f, 0 });
+        spatial = temporal;
+        spatial_surfaces = surfaces;
+        light_index.clear();
+        for (uint32_t i = 0; i < context.scene.lights.size(); ++i)
+            light_index[context.scene.lights[i]] = i;
+    }
+
+    bool progressive() const { return true; }
+
+    void end_pass(Context& context) {
+        // publish this pass' reservoirs for spatial reuse in the next one
+        #pragma omp parallel for
+        for (int i = 0; i < int(temporal.size()); ++i) {
+            spatial[i] = temporal[i];
+            spatial_surfaces[i] = surfaces[i];
+        }
+    }
+
+    // tiled layout: neighbouring pixels are likely to share cache lines
+    inline size_t index(uint32_t x, uint32_t y) const {
+        return (size_t(y / TILE) * tiles_w + x / TILE) * TILE * TILE + (y % TILE) * TILE + x % TILE;
+    }
+
+    // unshadowed contribution of light sample y at the shading point, in the measure of the sample's pdf
+    vec3 target(const Context& context, const SurfaceInteraction& hit, const vec3& w_o, const Reservoir& r) const {
+        const Light* light = context.scene.lights[r.light];
+        vec3 w_i = r.y;
+        float G = 1.f;
+        if (!light->is_infinite()) {
+            const vec3 to_light = r.y - hit.P;
+            const float dist2 = dot(to_light, to_light);
+            if (dist2 <= 0.f) return vec3(0);
+            w_i = to_light / sqrtf(dist2);
+            G = fabsf(dot(decode_octahedral(r.N), w_i)) / dist2;
+        }
+        const float cos_hit = dot(hit.N, w_i);
+        if (cos_hit <= 0.f) return vec3(0);
+        // diffuse target, the BRDFs are not implemented yet (as for the VPLs of ManyLights)
+        return hit.albedo() * INVPI * cos_hit * r.Le * G;
+    }
+
+    // shadow ray towards light sample y
+    Ray shadow_ray(const Context& context, const SurfaceInteraction& hit, const Reservoir& r) const {
+        if (context.scene.lights[r.light]->is_infinite())
+            return hit.spawn_ray(r.y);
+        const vec3 to_light = r.y - hit.P;
+        const float dist = length(to_light);
+        return hit.spawn_ray(to_light / dist, dist * (1.f - 1e-3f));
+    }
+
+    // stream a (candidate or reservoir) sample with given weight into the reservoir
+    inline static bool update(Reservoir& r, const Reservoir& sample, float weight, uint32_t M) {
+        r.w_sum += weight;
+        r.M += M;
+        if (weight <= 0.f || RNG::uniform<float>() * r.w_sum > weight) return false;
+        r.y = sample.y;
+        r.N = sample.N;
+        r.Le = sample.Le;
+        r.light = sample.light;
+        return true;
+    }
+
+    // combine a reservoir, re-evaluating its sample at the current shading point
+    void combine(const Context& context, const SurfaceInteraction& hit, const vec3& w_o, Reservoir& r, float& p_hat, const Reservoir& other) const {
+        if (other.M == 0 || other.W <= 0.f) return;
+        const float p_hat_other = luma(target(context, hit, w_o, other));
+        if (update(r, other, p_hat_other * other.W * other.M, other.M))
+            p_hat = p_hat_other;
+    }
+
+    void sample_pixel(Context& context, uint32_t x, uint32_t y, uint32_t samples) {
+        const Scene& scene = context.scene;
+        UniformSampler2D pixel_sampler, light_sampler;
+        UniformSampler1D select_sampler;
+        pixel_sampler.init(samples);
+        light_sampler.init(samples * NUM_CANDIDATES);
+        select_sampler.init(samples * NUM_CANDIDATES);
+        const size_t idx = index(x, y);
+
+        for (uint32_t s = 0; s < samples; ++s) {
+            RayDifferential diff;
+            Ray ray = context.cam.view_ray(x, y, w, h, diff, pixel_sampler.next());
+            const SurfaceInteraction hit = scene.intersect(ray, diff);
+            if (!hit.valid || hit.is_light()) {
+                surfaces[idx].depth = -1.f;
+                temporal[idx].M = 0;
+                context.fbo.add_sample(x, y, hit.valid ? hit.Le() : scene.Le(ray, diff.spread()));
+                continue;
+            }
+            const vec3 w_o = -ray.dir;
+
+            // resampled importance sampling of unshadowed light candidates
+            Reservoir r{ vec3(0), 0, vec3(0), 0, 0.f, 0.f, 0 };
+            float p_hat = 0.f;
+            for (uint32_t c = 0; c < NUM_CANDIDATES; ++c) {
+                const auto [light, p_select] = scene.sample_light_source(hit, select_sampler.next());
+                const vec2 sample = light_sampler.next();
+                if (!light || p_select <= 0.f) { r.M++; continue; }
+                const auto [pos, N, Le, pdf] = light->sample_point(sample);
+                if (pdf <= 0.f) { r.M++; continue; }
+                const Reservoir candidate{ pos, encode_octahedral(N), Le, light_index.at(light), 1.f, 1.f, 1 };
+                const float p_hat_c = luma(target(context, hit, w_o, candidate));
+                if (update(r, candidate, p_hat_c / (p_select * pdf), 1))
+                    p_hat = p_hat_c;
+            }
+            r.W = p_hat > 0.f ? r.w_sum / (r.M * p_hat) : 0.f;
+
+            // temporal reuse of this pixel's previous reservoir
+            const Reservoir prev = temporal[idx];
+            if (surfaces[idx].depth >= 0.f && prev.M > 0) {
+                Reservoir t = prev;
+                t.M = std::min(t.M, TEMPORAL_MAX_M * NUM_CANDIDATES);
+                Reservoir merged{ vec3(0), 0, vec3(0), 0, 0.f, 0.f, 0 };
+                float p_hat_merged = 0.f;
+                combine(context, hit, w_o, merged, p_hat_merged, r);
+                merged.M = std::max(merged.M, r.M); // count candidates even if none contributed
+                combine(context, hit, w_o, merged, p_hat_merged, t);
+                merged.W = p_hat_merged > 0.f ? merged.w_sum / (merged.M * p_hat_merged) : 0.f;
+                r = merged;
+                p_hat = p_hat_merged;
+            }
+
+            // spatial reuse of neighbouring reservoirs from the previous pass
+            const float depth = ray.tfar;
+            if (SPATIAL_NEIGHBORS > 0) {
+                Reservoir merged{ vec3(0), 0, vec3(0), 0, 0.f, 0.f, 0 };
+                float p_hat_merged = 0.f;
+                combine(context, hit, w_o, merged, p_hat_merged, r);
+                merged.M = std::max(merged.M, r.M);
+                for (uint32_t k = 0; k < SPATIAL_NEIGHBORS; ++k) {
+                    const vec2 offset = SPATIAL_RADIUS * (2.f * RNG::uniform<vec2>() - 1.f);
+                    const int nx = int(x) + int(offset.x), ny = int(y) + int(offset.y);
+                    if (nx < 0 || ny < 0 || nx >= int(w) || ny >= int(h) || (nx == int(x) && ny == int(y))) continue;
+                    const size_t n_idx = index(nx, ny);
+                    const Surface& n_surf = spatial_surfaces[n_idx];
+                    // skip geometrically dissimilar neighbours
+                    if (n_surf.depth < 0.f || fabsf(n_surf.depth - depth) > 0.1f * depth || dot(decode_octahedral(n_surf.N), hit.N) < 0.9f)
+                        continue;
+                    combine(context, hit, w_o, merged, p_hat_merged, spatial[n_idx]);
+                }
+                merged.W = p_hat_merged > 0.f ? merged.w_sum / (merged.M * p_hat_merged) : 0.f;
+                r = merged;
+                p_hat = p_hat_merged;
+            }
+
+            // single shadow ray for the selected sample
+            vec3 L(0);
+            if (r.W > 0.f) {
+                Ray sray = shadow_ray(context, hit, r);
+                if (scene.occluded(sray))
+                    r.W = 0.f; // do not propagate occluded samples
+                else
+                    L = target(context, hit, w_o, r) * r.W;
+            }
+            temporal[idx] = r;
+            surfaces[idx] = Surface{ depth, encode_octahedral(hit.N) };
+            context.fbo.add_sample(x, y, L);
+        }
+    }
+};
+
+static AlgorithmRegistrar<ReSTIR> registrar;
@@ -5,6 +5,8 @@
 #include "gi/random.h"
 #include "gi/light.h"
 #include "gi/ray.h"
+#include "gi/shadow_queue.h"
+#include <omp.h>
 
 
 using namespace std;
@@ -13,6 +15,25 @@ using namespace glm;
 struct SimpleRenderer : public Algorithm {
     inline static const std::string name = "SimpleRenderer";
 
+    bool BATCH_SHADOW_RAYS = true;      ///< Defer shadow rays into per-thread queues which are traced in batches
+
+    // data
+    std::vector<ShadowQueue> queues;    ///< Shadow ray queue per render thread
+
+    void read_config(const json11::Json& cfg) {
+        json_set_bool(cfg, "batch_shadow_rays", BATCH_SHADOW_RAYS);
+    }
+
+    // called once before each(!) rendering
+    void init(Context& context) {
+        queues.clear();
+        queues.resize(omp_get_max_threads());
+    }
+
+    void flush(Context& context) {
+        queues[omp_get_thread_num()].flush(context.scene, context.fbo);
+    }
+
     void sample_pixel(Context& context, uint32_t x, uint32_t y, uint32_t samples) {
         // some shortcuts
         const Camera& cam = context.cam;
@@ -45,6 +66,7 @@ struct SimpleRenderer : public Algorithm {
 
 
         std::vector<Ray> aa_ray(samples);
+        std::vector<RayDifferential> aa_diff(samples);
 
         std::vector<glm::vec2> jitter(samples);
         std::vector<glm::vec2> lens_dof(samples);
@@ -55,7 +77,7 @@ struct SimpleRenderer : public Algorithm {
             jitter[i] = halton_samp.next();
             lens_dof[i] = lens_sample.next();
 
-            aa_ray[i] = cam.view_ray(x, y, w, h, jitter[i], lens_dof[i]);
+            aa_ray[i] = cam.view_ray(x, y, w, h, aa_diff[i], jitter[i], lens_dof[i]);
 
         }
         vec3 L(0);
@@ -73,7 +95,7 @@ struct SimpleRenderer : public Algorithm {
 
         for(int i = 0; i < samples; i ++){
 
-            const SurfaceInteraction hit = scene.intersect(aa_ray[i]);
+            const SurfaceInteraction hit = scene.intersect(aa_ray[i], aa_diff[i]);
         // check if a hit was found
         if (hit.valid) {
             if (hit.is_light()) // direct light source hit
@@ -86,36 +108,41 @@ struct SimpleRenderer : public Algorithm {
                 // const auto [light_ptr, ignore_me] = scene.sample_light_source(...);
                 // auto [Li, shadow_ray, ignore_me2] = light_ptr->sample_Li(...);
 
-                const auto [light_ptr, ignore_me] = scene.sample_light_source(samp_light_source.next());
+                // selection depends on the shading point (light tree), thus divide by its pdf
+                const auto [light_ptr, light_pdf] = scene.sample_light_source(hit, samp_light_source.next());
 
 
+                if (!light_ptr || light_pdf <= 0.f) // no light source can contribute to this shading point
+                    L = glm::vec3(0.0f,0.0f,0.0f);
+                else {
                 auto [Li, shadow_ray, ignore_me2] = light_ptr->sample_Li(hit, samp_area_s.next());
+                Li /= light_pdf;
 
-                bool occluded = scene.occluded(shadow_ray);
-
-                if(!occluded){
+                float cos_term = glm::dot(glm::normalize(shadow_ray.dir), glm::normalize(hit.N));
 
+                if(cos_term < 0.0f){
 
-                    glm::vec3 n = hit.N;
+                    cos_term = 0.0f;
 
-                    float cos_term = glm::dot(glm::normalize(shadow_ray.dir), glm::normalize(n));
-
-
-                    if(cos_term < 0.0f){
+                }
 
-                        cos_term = 0.0f;
+                if (BATCH_SHADOW_RAYS) { // sample is committed once the queued shadow ray is traced
+                    queues[omp_get_thread_num()].push(scene, fbo, shadow_ray, cos_term * Li * hit.albedo(), x, y);
+                    continue;
+                }
 
-                    }
+                bool occluded = scene.occluded(shadow_ray);
 
+                if(!occluded){
 
                     L = cos_term* Li * hit.albedo();
 
-
                 }else{
 
                     L = glm::vec3(0.0f,0.0f,0.0f);
 
                 }
+                }
 
             }
 
@@ -123,7 +150,7 @@ struct SimpleRenderer : public Algorithm {
 
         }
         else{ // ray esacped the scene
-                L = scene.Le(aa_ray[i]);}
+                L = scene.Le(aa_ray[i], aa_diff[i].spread());}
                 // add result to framebuffer
                 fbo.add_sample(x, y, L);
 
@@ -1,8 +1,11 @@
 #include "context.h"
 #include "gi/ray.h"
 #include "gi/surface.h"
+#include "gi/mesh.h"
 #include "gi/material.h"
 #include "gi/light.h"
+#include "gi/envmap_cache.h"
+#include "gi/texture_file.h"
 #include "gi/random.h"
 #include "gi/timer.h"
 
@@ -258,7 +261,7 @@ bool mouse_handler(GLFWwindow *window, Context& ctx, float dt) {
 // ---------------------------------------------------------------------------------
 // Context
 
-Context::Context(uint32_t w, uint32_t h, uint32_t sppx)
+Context::Context(uint32_t w, uint32_t h, uint32_t sppx, bool headless)
     : device(rtcNewDevice(0)), fbo(w, h, sppx), scene(device), cam(), algorithm(), window(0), quad(0) {
     // check embree device on errors
     RTCError embree_error = rtcGetDeviceError(device);
@@ -274,6 +277,7 @@ Context::Context(uint32_t w, uint32_t h, uint32_t sppx)
     rtcSetDeviceErrorFunction(device, embreeErrorFunc, 0);
     rtcSetDeviceMemoryMonitorFunction(device, embreeMemFunc, 0);
 
+    if (headless) return;
     // try to init GLFW
     if (!glfwInit()) {
         printf("No OpenGL context -> rendering offline.\n");
@@ -482,6 +486,19 @@ void Context::run() {
                                     restart = true;
                                 }
                             }
+                            if (dynamic_cast<ShapeLight*>(scene.lights[i])) {
+                                ImGui::Text("ShapeLight");
+                                ShapeLight* l = static_cast<ShapeLight*>(scene.lights[i]);
+                                ImGui::Text("Material name: %s", l->shape.mat->name.c_str());
+                                if (ImGui::ColorEdit3("color", &l->shape.mat->albedo_col.x))
+                                    restart = true;
+                                if (ImGui::DragFloat("power", &l->shape.mat->emissive_strength, 0.1f, 0.1f, FLT_MAX))
+                                    restart = true;
+                                if (ImGui::Button("Extinguish")) {
+                                    l->shape.mat->emissive_strength = 0.f;
+                                    restart = true;
+                                }
+                            }
                             if (dynamic_cast<SkyLight*>(scene.lights[i])) {
                                 ImGui::Text("SkyLight");
                                 SkyLight* l = static_cast<SkyLight*>(scene.lights[i]);
@@ -511,15 +528,15 @@ void Context::run() {
                                 if (ImGui::ColorEdit3("albedo", &mat_ptr->albedo_col.x))
                                     restart = true;
                             } else
-                                ImGui::Text("albedo map: %s", mat_ptr->albedo_tex.src_path.c_str());
+                                ImGui::Text("albedo map: %s", mat_ptr->albedo_tex->src_path.c_str());
                             if (mat_ptr->normal_tex)
-                                ImGui::Text("normal map: %s", mat_ptr->normal_tex.src_path.c_str());
+                                ImGui::Text("normal map: %s", mat_ptr->normal_tex->src_path.c_str());
                             if (mat_ptr->alpha_tex)
-                                ImGui::Text("alpha map: %s", mat_ptr->alpha_tex.src_path.c_str());
+                                ImGui::Text("alpha map: %s", mat_ptr->alpha_tex->src_path.c_str());
                             if (mat_ptr->roughness_tex)
-                                ImGui::Text("roughness map: %s", mat_ptr->roughness_tex.src_path.c_str());
+                                ImGui::Text("roughness map: %s", mat_ptr->roughness_tex->src_path.c_str());
                             if (mat_ptr->emissive_tex)
-                                ImGui::Text("emissive map: %s", mat_ptr->emissive_tex.src_path.c_str());
+                                ImGui::Text("emissive map: %s", mat_ptr->emissive_tex->src_path.c_str());
                             if (ImGui::SliderFloat("ior", &mat_ptr->ior, 1.f, 3.f))
                                 restart = true;
                             if (ImGui::SliderFloat("absorb", &mat_ptr->absorb, 0.f, 3.f))
@@ -894,7 +911,27 @@ json11::Json Context::to_json() const {
         { "rr_min_path_length", int(RR_MIN_PATH_LENGTH) },
         { "rr_threshold", RR_THRESHOLD },
         { "beauty_render", BEAUTY_RENDER },
-        { "error_eps", ERROR_EPS }
+        { "error_eps", ERROR_EPS },
+        { "compress_mesh_attributes", Mesh::COMPRESS_ATTRIBUTES },
+        { "precompute_triangle_data", Mesh::PRECOMPUTE_TRIANGLES },
+        { "alpha_mask", Mesh::ALPHA_MASK },
+        { "light_tree", Scene::USE_LIGHT_TREE },
+        { "envmap_disk_cache", EnvmapCache::ENABLED },
+        { "envmap_cache_dir", EnvmapCache::DIR },
+        { "envmap_mipmaps", SkyLight::MIPMAPS },
+        { "envmap_octahedral", SkyLight::OCTAHEDRAL },
+        { "envmap_cubemap", SkyLight::CUBEMAP },
+        { "envmap_format", Texture::format_name(SkyLight::FORMAT) },
+        { "texture_mipmaps", Texture::MIPMAPS },
+        { "texture_compact_ldr", Texture::COMPACT_LDR },
+        { "texture_stats", Texture::STATS },
+        { "texture_hdr_format", Texture::format_name(Texture::HDR_FORMAT) },
+        { "texture_paging", TileCache::ENABLED },
+        { "texture_cache_mb", int(TileCache::BUDGET_MB) },
+        { "texture_cache_dir", TileCache::DIR },
+        { "texture_file_cache", TextureFile::ENABLED },
+        { "texture_file_dir", TextureFile::DIR },
+        { "asset_cache_mb", int(scene.mesh_cache.budget >> 20) }
     };
 }
 
@@ -908,6 +945,30 @@ void Context::from_json(const json11::Json& cfg) {
         json_set_float(cfg, "rr_threshold", RR_THRESHOLD);
         json_set_bool(cfg, "beauty_render", BEAUTY_RENDER);
         json_set_float(cfg, "error_eps", ERROR_EPS);
+        json_set_bool(cfg, "compress_mesh_attributes", Mesh::COMPRESS_ATTRIBUTES);
+        json_set_bool(cfg, "precompute_triangle_data", Mesh::PRECOMPUTE_TRIANGLES);
+        json_set_bool(cfg, "alpha_mask", Mesh::ALPHA_MASK);
+        json_set_bool(cfg, "light_tree", Scene::USE_LIGHT_TREE);
+        json_set_bool(cfg, "envmap_disk_cache", EnvmapCache::ENABLED);
+        json_set_string(cfg, "envmap_cache_dir", EnvmapCache::DIR);
+        json_set_bool(cfg, "envmap_mipmaps", SkyLight::MIPMAPS);
+        json_set_bool(cfg, "envmap_octahedral", SkyLight::OCTAHEDRAL);
+        json_set_bool(cfg, "envmap_cubemap", SkyLight::CUBEMAP);
+        if (cfg["envmap_format"].is_string())
+            SkyLight::FORMAT = Texture::parse_format(cfg["envmap_format"].string_value());
+        json_set_bool(cfg, "texture_mipmaps", Texture::MIPMAPS);
+        json_set_bool(cfg, "texture_compact_ldr", Texture::COMPACT_LDR);
+        json_set_bool(cfg, "texture_stats", Texture::STATS);
+        if (cfg["texture_hdr_format"].is_string())
+            Texture::HDR_FORMAT = Texture::parse_format(cfg["texture_hdr_format"].string_value());
+        json_set_bool(cfg, "texture_paging", TileCache::ENABLED);
+        json_set_size(cfg, "texture_cache_mb", TileCache::BUDGET_MB);
+        json_set_string(cfg, "texture_cache_dir", TileCache::DIR);
+        json_set_bool(cfg, "texture_file_cache", TextureFile::ENABLED);
+        json_set_string(cfg, "texture_file_dir", TextureFile::DIR);
+        uint32_t cache_mb = scene.mesh_cache.budget >> 20;
+        json_set_uint(cfg, "asset_cache_mb", cache_mb);
+        scene.mesh_cache.budget = texture_cache().budget = size_t(cache_mb) << 20;
         // parse algorithm, fbo, scene and cam
         if (cfg["algorithm"].is_string()) {
             algorithm = cfg["algorithm"].string_value();
@@ -21,8 +21,9 @@ public:
      * @param w Rendering width
      * @param h Rendering height
      * @param sppx Samples per pixel
+     * @param headless Skip creating the preview window and GUI, e.g. for offline tools
      */
-    Context(uint32_t w = 1280, uint32_t h = 720, uint32_t sppx = 10);
+    Context(uint32_t w = 1280, uint32_t h = 720, uint32_t sppx = 10, bool headless = false);
 
     /**
      * @brief Destructor
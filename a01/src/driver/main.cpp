@@ -1,8 +1,52 @@
 #include "context.h"
 #include "gi/random.h"
 #include "gi/distribution.h"
+#include "gi/light.h"
+#include "gi/texture.h"
+#include "gi/texture_file.h"
+#include <string>
 
 int main(int argc, char** argv) {
+    // offline conversion (headless): load the given configs, meshes or images once to fill the preconverted texture cache, e.g.
+    // gi --convert-textures scene.json (the configs' texture settings define the stored formats)
+    if (argc > 1 && std::string(argv[1]) == "--convert-textures") {
+        TextureFile::ENABLED = true;
+        Context context(1280, 720, 10, true);
+        for (int i = 2; i < argc; ++i) {
+            // images are converted as (sRGB) material textures, configs and meshes load their materials' textures
+            const std::filesystem::path path = argv[i];
+            if (path.extension() == ".hdr" || path.extension() == ".png" || path.extension() == ".jpg")
+                Texture().load(path);
+            else
+                context.load(path);
+        }
+        return 0;
+    }
+
+    // timings of building and sampling Distribution1D with the CDF and the alias table backend
+    if (argc > 1 && std::string(argv[1]) == "--benchmark-distributions") {
+        benchmark_distributions();
+        return 0;
+    }
+
+    // size and precision of the compact texture formats relative to RGB32F for the given images
+    if (argc > 1 && std::string(argv[1]) == "--debug-texture-formats") {
+        for (int i = 2; i < argc; ++i)
+            debug_texture_formats(Texture(argv[i]));
+        return 0;
+    }
+
+    // timings and accuracy of lat-long, octahedral and cube map lookups for the given environment maps
+    if (argc > 1 && std::string(argv[1]) == "--benchmark-envmap") {
+        for (int i = 2; i < argc; ++i) {
+            SkyLight sky;
+            sky.load(argv[i], glm::vec3(0), 1.f);
+            sky.commit();
+            debug_envmap_lookups(sky);
+        }
+        return 0;
+    }
+
     plot_all_samplers2D();
 
     // init context
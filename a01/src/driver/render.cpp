@@ -5,10 +5,59 @@
 
 #include "gi/rng.h"
 #include "gi/color.h"
+#include "gi/tile_cache.h"
+#include "gi/material.h"
+#include "gi/light.h"
 
 // ---------------------------------------------------------------------------------
 // helper functions
 
+// print lookup statistics of the given texture and its mip levels
+static void print_texture_stats(const char* label, const Texture& tex, const std::unordered_map<const Texture*, TextureStats::Counters>& stats) {
+    TextureStats::Counters total;
+    for (size_t l = 0; l < tex.levels(); ++l) {
+        auto it = stats.find(&tex.level(l));
+        if (it != stats.end()) total.merge(it->second, l);
+    }
+    if (total.lookups == 0) return;
+    // estimated footprint: storage of all levels read from
+    size_t footprint = 0;
+    for (size_t l = 0; l < tex.levels(); ++l)
+        if (total.levels[std::min<size_t>(l, TextureStats::MAX_LEVELS - 1)] > 0)
+            footprint += tex.level(l).width() * tex.level(l).height() * (tex.is_paged() ? sizeof(glm::vec3) : Texture::bytes_per_texel(tex.storage_format()));
+    printf("    %s %s (%lux%lu %s%s): %lu lookups, %lu texels, footprint %.1f MB, levels:", label, tex.path().string().c_str(),
+            (unsigned long)tex.width(), (unsigned long)tex.height(), Texture::format_name(tex.storage_format()).c_str(),
+            tex.is_paged() ? ", paged" : tex.is_mapped() ? ", mapped" : "", (unsigned long)total.lookups, (unsigned long)total.fetches, footprint / double(1 << 20));
+    for (uint32_t l = 0; l < TextureStats::MAX_LEVELS; ++l)
+        if (total.levels[l] > 0)
+            printf(" %u: %.1f%%", l, 100.0 * total.levels[l] / total.lookups);
+    if (tex.is_paged())
+        printf(", tile hit rate: %.2f%% (%lu page-ins)", 100.0 * (1.0 - fmin(1.0, tex.paged->page_ins() / double(total.fetches))),
+                (unsigned long)tex.paged->page_ins());
+    printf("\n");
+}
+
+// dump texture statistics per material (and environment map)
+static void print_texture_stats(const Context& ctx) {
+    const auto stats = TextureStats::collect();
+    printf("Texture statistics:\n");
+    for (const auto& mat : ctx.scene.materials) {
+        if (!mat->albedo_tex && !mat->normal_tex && !mat->alpha_tex && !mat->roughness_tex && !mat->emissive_tex) continue;
+        printf("  %s:\n", mat->name.c_str());
+        if (mat->albedo_tex) print_texture_stats("albedo", *mat->albedo_tex, stats);
+        if (mat->normal_tex) print_texture_stats("normal", *mat->normal_tex, stats);
+        if (mat->alpha_tex) print_texture_stats("alpha", *mat->alpha_tex, stats);
+        if (mat->roughness_tex) print_texture_stats("roughness", *mat->roughness_tex, stats);
+        if (mat->emissive_tex) print_texture_stats("emissive", *mat->emissive_tex, stats);
+    }
+    if (ctx.scene.sky) {
+        printf("  environment:\n");
+        if (ctx.scene.sky->tex) print_texture_stats("envmap", *ctx.scene.sky->tex, stats);
+        if (ctx.scene.sky->oct) print_texture_stats("octahedral", *ctx.scene.sky->oct, stats);
+        if (ctx.scene.sky->cube) print_texture_stats("cube map", *ctx.scene.sky->cube, stats);
+    }
+}
+
 static const size_t TILESIZE = 32;
 
 inline float block_convergence(const Context& ctx, size_t bx, size_t by) {
@@ -39,6 +88,7 @@ void render(Context& ctx) {
 	}
 
     CLEAR_STATS();
+    TextureStats::clear();
     Timer timings;
 
     timings.start("commit");
@@ -59,23 +109,49 @@ void render(Context& ctx) {
     size_t w = ctx.fbo.width(), h = ctx.fbo.height(), sppx = ctx.fbo.samples();
     // push 1sppx quickly
     const auto start = std::chrono::system_clock::now();
-    #pragma omp parallel for
-    for (int y = 0; y < int(h); ++y) {
-        for (int x = 0; x < int(w); ++x) {
-            if (ctx.abort) break;
-            algo->sample_pixel(ctx, x, y, 1);
+    #pragma omp parallel
+    {
+        #pragma omp for
+        for (int y = 0; y < int(h); ++y) {
+            for (int x = 0; x < int(w); ++x) {
+                if (ctx.abort) break;
+                algo->sample_pixel(ctx, x, y, 1);
+            }
         }
+        algo->flush(ctx);
     }
     const auto end = std::chrono::system_clock::now();
     const size_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     if (ctx.abort) return;
     printf("Approx. render time using algorithm \"%s\": %lum, %lus\n", ctx.algorithm.c_str(), (sppx - 1) * ms / 60000, ((sppx - 1) * ms / 1000) % 60);
     // render rest of samples
-    #pragma omp parallel for
-    for (int y = 0; y < int(h); ++y) {
-        for (int x = 0; x < int(w); ++x) {
-            if (ctx.abort) break;
-            algo->sample_pixel(ctx, x, y, sppx - 1);
+    if (algo->progressive()) {
+        algo->end_pass(ctx);
+        for (size_t pass = 1; pass < sppx && !ctx.abort; ++pass) {
+            #pragma omp parallel
+            {
+                #pragma omp for
+                for (int y = 0; y < int(h); ++y) {
+                    for (int x = 0; x < int(w); ++x) {
+                        if (ctx.abort) break;
+                        algo->sample_pixel(ctx, x, y, 1);
+                    }
+                }
+                algo->flush(ctx);
+            }
+            algo->end_pass(ctx);
+        }
+    } else {
+        #pragma omp parallel
+        {
+            #pragma omp for
+            for (int y = 0; y < int(h); ++y) {
+                for (int x = 0; x < int(w); ++x) {
+                    if (ctx.abort) break;
+                    algo->sample_pixel(ctx, x, y, sppx - 1);
+                }
+            }
+            algo->flush(ctx);
         }
     }
     timings.stop("render");
@@ -106,6 +182,7 @@ void render(Context& ctx) {
                 for (uint32_t y = by * TILESIZE; y < glm::min(ctx.fbo.h, (by + 1) * TILESIZE); ++y)
                     for (uint32_t x = bx * TILESIZE; x < glm::min(ctx.fbo.w, (bx + 1) * TILESIZE); ++x)
                         algo->sample_pixel(ctx, x, y, 32);
+                algo->flush(ctx); // commit deferred samples before measuring convergence
                 const float conv = block_convergence(ctx, bx, by);
                 if (conv > ctx.ERROR_EPS)
                     unconverged.push(by * TILES_W + bx, conv);
@@ -129,5 +206,12 @@ void render(Context& ctx) {
 
     ctx.fbo.save("output.png");
     timings.print();
+    if (TileCache::ENABLED) {
+        const TileCache& tiles = TileCache::instance();
+        printf("Texture tiles: %.1f MB resident, %lu page-ins, %lu evictions\n", tiles.nbytes() / double(1 << 20),
+                (unsigned long)tiles.page_ins(), (unsigned long)tiles.evictions());
+    }
+    if (Texture::STATS)
+        print_texture_stats(ctx);
     PRINT_STATS();
 }
@@ -33,6 +33,27 @@ public:
      */
     virtual void sample_pixel(Context& context, uint32_t x, uint32_t y, uint32_t samples) = 0;
 
+    /**
+     * @brief Render in progressive passes of one sample per pixel, with end_pass() called in between
+     *
+     * @return true if the algorithm shares data between passes, e.g. for reuse across neighbouring pixels
+     */
+    virtual bool progressive() const { return false; }
+
+    /**
+     * @brief Called after each full pass over the framebuffer (progressive algorithms only)
+     *
+     * @param context Context reference, providing the context
+     */
+    virtual void end_pass(Context& context) {}
+
+    /**
+     * @brief Called by each render thread after its share of a pass, e.g. to commit samples deferred for batching
+     *
+     * @param context Context reference, providing the context
+     */
+    virtual void flush(Context& context) {}
+
     /**
      * @brief Static algorithm management (populated via AlgorithmRegistrar)
      */
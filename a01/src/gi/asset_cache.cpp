@@ -0,0 +1,40 @@
+#include "asset_cache.h"
+#include "texture.h"
+
+// -------------------------------------------
+// AssetKey
+
+AssetKey::AssetKey(const std::filesystem::path& path, uint64_t options) : options(options) {
+    std::error_code ec;
+    this->path = std::filesystem::weakly_canonical(path, ec);
+    if (ec) this->path = path;
+    mtime = std::filesystem::last_write_time(this->path, ec);
+    if (ec) mtime = std::filesystem::file_time_type::min();
+}
+
+// -------------------------------------------
+// Texture cache
+
+AssetCache<Texture>& texture_cache() {
+    static AssetCache<Texture> cache(size_t(2) << 30);
+    return cache;
+}
+
+std::shared_ptr<Texture> load_texture_cached(const std::filesystem::path& path, bool sRGB) {
+    const auto [tex, cached] = texture_cache().get(AssetKey(path, sRGB ? TEXTURE_SRGB : 0), [&]() {
+        return std::make_shared<Texture>(path, sRGB);
+    });
+    return tex;
+}
+
+std::shared_ptr<Texture> load_alpha_cached(const std::filesystem::path& path, const std::shared_ptr<Texture>& rgba) {
+    const auto [tex, cached] = texture_cache().get(AssetKey(path, TEXTURE_ALPHA), [&]() {
+        auto alpha = std::make_shared<Texture>();
+        if (rgba && rgba->storage_format() == Texture::RGBA8 && !rgba->is_paged())
+            alpha->load_alpha(*rgba);
+        else
+            alpha->load_alpha(path);
+        return alpha;
+    });
+    return tex;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <filesystem>
+
+class Texture;
+
+/**
+ * @brief Key identifying an asset on disk: resolved path, modification time and import options
+ */
+struct AssetKey {
+    /**
+     * @brief Construct from a file on disk, querying its current modification time
+     *
+     * @param path Resolved path to the file
+     * @param options Import options that affect the in-memory representation
+     */
+    AssetKey(const std::filesystem::path& path, uint64_t options = 0);
+
+    inline bool operator==(const AssetKey& o) const { return path == o.path && mtime == o.mtime && options == o.options; }
+    inline bool operator<(const AssetKey& o) const { return std::tie(path, mtime, options) < std::tie(o.path, o.mtime, o.options); }
+
+    // data
+    std::filesystem::path path;             ///< Resolved (canonical, if possible) path
+    std::filesystem::file_time_type mtime;  ///< Modification time when the key was created
+    uint64_t options;                       ///< Import options
+};
+
+/**
+ * @brief LRU cache of shared assets with a memory budget
+ * @note Assets still referenced outside of the cache are never evicted, thus the budget only limits what
+ * is kept around for later reuse. T must provide a size_t nbytes() const member.
+ *
+ * @tparam T Asset type
+ */
+template <typename T> class AssetCache {
+public:
+    AssetCache(size_t budget) : budget(budget), tick(0) {}
+
+    /**
+     * @brief Fetch an asset from the cache, or load and insert it on a miss
+     *
+     * @param key Key of the asset
+     * @param load Callable returning a std::shared_ptr<T>, invoked on a cache miss
+     *
+     * @return Tuple consisting of:
+     *      - Shared pointer to the asset (std::shared_ptr<T>)
+     *      - true if the asset was served from the cache, false if it was loaded (bool)
+     */
+    template <typename Loader> std::tuple<std::shared_ptr<T>, bool> get(const AssetKey& key, Loader load) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            it->second.last_use = ++tick;
+            return { it->second.asset, true };
+        }
+        // drop unreferenced stale versions of the same file
+        for (auto stale = entries.begin(); stale != entries.end(); )
+            stale = stale->first.path == key.path && stale->second.asset.use_count() == 1 ? entries.erase(stale) : std::next(stale);
+        std::shared_ptr<T> asset = load();
+        entries.emplace(key, Entry{ asset, ++tick });
+        return { asset, false };
+    }
+
+    /**
+     * @brief Look up an asset without loading it on a miss
+     *
+     * @param key Key of the asset
+     *
+     * @return Shared pointer to the cached asset, or nullptr if not present
+     */
+    std::shared_ptr<T> find(const AssetKey& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end()) return nullptr;
+        it->second.last_use = ++tick;
+        return it->second.asset;
+    }
+
+    /**
+     * @brief Evict least recently used, otherwise unreferenced assets until the cache fits into its budget
+     */
+    void evict() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t total = nbytes_unlocked();
+        while (total > budget) {
+            auto lru = entries.end();
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+                if (it->second.asset.use_count() == 1 && (lru == entries.end() || it->second.last_use < lru->second.last_use))
+                    lru = it;
+            if (lru == entries.end()) break; // everything left is in use
+            total -= lru->second.asset->nbytes();
+            entries.erase(lru);
+        }
+    }
+
+    /**
+     * @brief Drop all cached assets (assets referenced elsewhere stay alive until released)
+     */
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+    }
+
+    /**
+     * @brief Query memory held by all cached assets
+     *
+     * @return Size in bytes
+     */
+    size_t nbytes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return nbytes_unlocked();
+    }
+
+    // data
+    size_t budget; ///< Memory budget in bytes
+
+private:
+    size_t nbytes_unlocked() const {
+        size_t total = 0;
+        for (const auto& [key, entry] : entries)
+            total += entry.asset->nbytes();
+        return total;
+    }
+
+    struct Entry {
+        std::shared_ptr<T> asset;
+        uint64_t last_use;
+    };
+
+    std::map<AssetKey, Entry> entries;
+    std::mutex mutex;
+    uint64_t tick;
+};
+
+/**
+ * @brief Process-wide texture cache (textures and environment maps)
+ *
+ * @return Reference to the texture cache
+ */
+AssetCache<Texture>& texture_cache();
+
+// texture cache key options
+static constexpr uint64_t TEXTURE_SRGB = 1;     ///< Converted from sRGB to linear
+static constexpr uint64_t TEXTURE_ALPHA = 2;    ///< Alpha channel only
+static constexpr uint64_t TEXTURE_ENVMAP = 4;   ///< Environment map served from the EnvmapCache
+
+/**
+ * @brief Load a texture via the process-wide texture cache
+ *
+ * @param path Resolved path to the texture on disk
+ * @param sRGB Convert from sRGB to linear color space (LDR only)
+ *
+ * @return Shared pointer to the (possibly cached) texture
+ */
+std::shared_ptr<Texture> load_texture_cached(const std::filesystem::path& path, bool sRGB = true);
+
+/**
+ * @brief Load the alpha channel of a texture via the process-wide texture cache
+ *
+ * @param path Resolved path to the texture on disk
+ * @param rgba Already loaded texture of the same file, its alpha channel is extracted instead of decoding the file again (optional)
+ *
+ * @return Shared pointer to the (possibly cached) single channel alpha texture
+ */
+std::shared_ptr<Texture> load_alpha_cached(const std::filesystem::path& path, const std::shared_ptr<Texture>& rgba = nullptr);
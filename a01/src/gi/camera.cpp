@@ -28,6 +28,18 @@ Ray Camera::view_ray(uint32_t x, uint32_t y, uint32_t w, uint32_t h, const glm::
     return view_ray;
 }
 
+Ray Camera::view_ray(uint32_t x, uint32_t y, uint32_t w, uint32_t h, RayDifferential& diff, const glm::vec2& pixel_sample, const glm::vec2& lens_sample) const {
+    const Ray ray = view_ray(x, y, w, h, pixel_sample, lens_sample);
+    // same samples for the offset rays, s.t. only the pixel position differs
+    const Ray rx = view_ray(x + 1, y, w, h, pixel_sample, lens_sample);
+    const Ray ry = view_ray(x, y + 1, w, h, pixel_sample, lens_sample);
+    diff.dOdx = rx.org - ray.org;
+    diff.dOdy = ry.org - ray.org;
+    diff.dDdx = rx.dir - ray.dir;
+    diff.dDdy = ry.dir - ray.dir;
+    return ray;
+}
+
 Ray Camera::perspective_view_ray(uint32_t x, uint32_t y, uint32_t w, uint32_t h, const glm::vec2& pixel_sample) const {
     // TODO ASSIGNMENT1
     // jitter the ray throughout the pixel (x, y) using pixel_sample
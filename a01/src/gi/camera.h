@@ -37,6 +37,21 @@ public:
      */
     Ray view_ray(uint32_t x, uint32_t y, uint32_t w, uint32_t h, const glm::vec2& pixel_sample = glm::vec2(.5f), const glm::vec2& lens_sample = glm::vec2(.5)) const;
 
+    /**
+     * @brief Compute a view ray for a given pixel, including ray differentials towards the neighbouring pixels
+     *
+     * @param x Pixel coordinate
+     * @param y Pixel coordinate
+     * @param w Image/Framebuffer width
+     * @param h Image/Framebuffer height
+     * @param diff Ref to RayDifferential, where the differentials of the returned ray will be written to
+     * @param pixel_sample Random sample in [0, 1) for anti-aliasing (optional)
+     * @param lens_sample Random sample in [0, 1) for sampling the lens for DOF (optional)
+     *
+     * @return View ray through pixel with the coordinates (x, y) optionally jittered for AA and/or DOF
+     */
+    Ray view_ray(uint32_t x, uint32_t y, uint32_t w, uint32_t h, RayDifferential& diff, const glm::vec2& pixel_sample = glm::vec2(.5f), const glm::vec2& lens_sample = glm::vec2(.5)) const;
+
     /**
      * @brief Compute a perspective view ray for a given pixel
      *
@@ -3,13 +3,62 @@
 #include "texture.h"
 #include "random.h"
 #include "color.h"
+#include "timer.h"
 #include <iostream>
+#include <omp.h>
 
 // ----------------------------------------------------
 // Distribution1D
 
-Distribution1D::Distribution1D(const float* f, uint32_t N) : func(f, f + N), cdf(N + 1) {
-    f_integral = N;
+Distribution1D::Distribution1D(const float* f, uint32_t N, Backend backend) : func(f, f + N), f_integral(0) {
+    assert(N > 0);
+    #pragma omp parallel for simd
+    for (int i = 0; i < int(N); ++i)
+        func[i] = fabsf(func[i]);
+    if (backend == ALIAS) {
+        alias = std::make_shared<const AliasTable>(func.data(), N);
+        f_integral = alias->integral();
+        return;
+    }
+    // blocked prefix sum: per-block sums, exclusive scan over blocks, then per-block scan
+    cdf.resize(N + 1);
+    cdf[0] = 0;
+    const uint32_t n_blocks = N < (1 << 16) ? 1 : std::min<uint32_t>(omp_get_max_threads() * 4, N >> 12);
+    const uint32_t block_size = (N + n_blocks - 1) / n_blocks;
+    std::vector<double> offsets(n_blocks + 1, 0.0);
+    #pragma omp parallel for if(n_blocks > 1)
+    for (int b = 0; b < int(n_blocks); ++b) {
+        const uint32_t beg = b * block_size, end = std::min(N, beg + block_size);
+        double sum = 0;
+        #pragma omp simd reduction(+ : sum)
+        for (uint32_t i = beg; i < end; ++i)
+            sum += func[i];
+        offsets[b + 1] = sum;
+    }
+    for (uint32_t b = 0; b < n_blocks; ++b)
+        offsets[b + 1] += offsets[b];
+    #pragma omp parallel for if(n_blocks > 1)
+    for (int b = 0; b < int(n_blocks); ++b) {
+        const uint32_t beg = b * block_size, end = std::min(N, beg + block_size);
+        double sum = offsets[b];
+        for (uint32_t i = beg; i < end; ++i) {
+            sum += func[i];
+            cdf[i + 1] = sum;
+        }
+    }
+    f_integral = offsets[n_blocks];
+    // normalize (fall back to uniform for degenerate functions)
+    if (f_integral > 0) {
+        const float inv = float(1.0 / f_integral);
+        #pragma omp parallel for simd
+        for (int i = 1; i <= int(N); ++i)
+            cdf[i] *= inv;
+    } else {
+        #pragma omp parallel for simd
+        for (int i = 1; i <= int(N); ++i)
+            cdf[i] = i / float(N);
+    }
+    cdf[N] = 1.f;
 }
 
 double Distribution1D::integral() const {
@@ -22,46 +71,164 @@ double Distribution1D::unit_integral() const {
 
 float Distribution1D::pdf(float sample) const {
     assert(sample >= 0 && sample < 1);
-    return func[sample * size()] / unit_integral();
+    if (f_integral <= 0) return 1.f;
+    return func[std::min(uint32_t(sample * size()), size() - 1)] / unit_integral();
 }
 
 float Distribution1D::pdf(size_t index) const {
     assert(index < size());
+    if (f_integral <= 0) return 1.f / size();
     return func[index] / integral();
 }
 
 std::tuple<float, float> Distribution1D::sample_01(float sample) const {
-    return { sample, 1.f / size() };
+    if (alias) {
+        const auto [index, pdf, remapped] = alias->sample_index(sample);
+        return { std::min((index + remapped) / size(), 0x1.fffffep-1f), pdf * size() };
+    }
+    const uint32_t index = std::upper_bound(cdf.begin(), cdf.end(), sample) - cdf.begin() - 1;
+    const uint32_t i = std::min(index, size() - 1);
+    const float width = cdf[i + 1] - cdf[i];
+    const float du = width > 0 ? (sample - cdf[i]) / width : 0.f;
+    return { std::min((i + du) / size(), 0x1.fffffep-1f), pdf(size_t(i)) * size() };
 }
 
 std::tuple<uint32_t, float> Distribution1D::sample_index(float sample) const {
-    return { sample * size(), 1.f / size() };
+    if (alias) {
+        const auto [index, pdf, remapped] = alias->sample_index(sample);
+        return { index, pdf };
+    }
+    const uint32_t index = std::upper_bound(cdf.begin(), cdf.end(), sample) - cdf.begin() - 1;
+    const uint32_t i = std::min(index, size() - 1);
+    return { i, pdf(size_t(i)) };
 }
 
 // ----------------------------------------------------
-// Distribution2D
+// AliasTable
 
-Distribution2D::Distribution2D(const float* f, uint32_t w, uint32_t h) {
+AliasTable::AliasTable(const float* f, uint32_t N) : bins(N), f_integral(0) {
+    assert(N > 0);
+    // integrate
+    double sum = 0;
+    #pragma omp parallel for reduction(+ : sum)
+    for (int i = 0; i < int(N); ++i)
+        sum += f[i];
+    f_integral = sum;
+    // scale to mean 1 (fall back to uniform for degenerate functions)
+    std::vector<float> scaled(N);
+    #pragma omp parallel for
+    for (int i = 0; i < int(N); ++i) {
+        bins[i].pdf = sum > 0 ? float(f[i] / sum) : 1.f / N;
+        scaled[i] = bins[i].pdf * N;
+    }
+    // classify into under- and overfull bins
+    std::vector<uint32_t> small, large;
+    small.reserve(N); large.reserve(N);
+    for (uint32_t i = 0; i < N; ++i)
+        (scaled[i] < 1.f ? small : large).push_back(i);
+    // pair up (Vose)
+    while (!small.empty() && !large.empty()) {
+        const uint32_t s = small.back(); small.pop_back();
+        const uint32_t l = large.back();
+        bins[s].q = scaled[s];
+        bins[s].alias = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.f;
+        if (scaled[l] < 1.f) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // remaining bins are (up to rounding) exactly full
+    for (uint32_t i : large) { bins[i].q = 1.f; bins[i].alias = i; }
+    for (uint32_t i : small) { bins[i].q = 1.f; bins[i].alias = i; }
+    // cache alias pdfs
+    #pragma omp parallel for
+    for (int i = 0; i < int(N); ++i)
+        bins[i].alias_pdf = bins[bins[i].alias].pdf;
 }
 
-Distribution2D::~Distribution2D() {
+// ----------------------------------------------------
+// Distribution2D
 
+Distribution2D::Distribution2D(const float* f, uint32_t w, uint32_t h) : w(w), h(h), storage(table_size(w, h)), f_integral(0) {
+    assert(w > 0 && h > 0);
+    float* func = storage.data();
+    float* conditional = func + size_t(w) * h;
+    float* marginal = conditional + size_t(w + 1) * h;
+    this->func = func;
+    this->conditional = conditional;
+    this->marginal = marginal;
+    // conditional CDFs (rows are independent)
+    std::vector<double> row_integral(h);
+    #pragma omp parallel for
+    for (int y = 0; y < int(h); ++y) {
+        const float* src = f + size_t(y) * w;
+        float* row = func + size_t(y) * w;
+        float* cdf = conditional + size_t(y) * (w + 1);
+        double sum = 0;
+        cdf[0] = 0;
+        for (uint32_t x = 0; x < w; ++x) {
+            row[x] = fabsf(src[x]);
+            sum += row[x];
+            cdf[x + 1] = sum;
+        }
+        row_integral[y] = sum;
+        if (sum > 0) {
+            const float inv = float(1.0 / sum);
+            #pragma omp simd
+            for (uint32_t x = 1; x <= w; ++x)
+                cdf[x] *= inv;
+        } else {
+            #pragma omp simd
+            for (uint32_t x = 1; x <= w; ++x)
+                cdf[x] = x / float(w);
+        }
+        cdf[w] = 1.f;
+    }
+    // marginal CDF over row integrals
+    double sum = 0;
+    marginal[0] = 0;
+    for (uint32_t y = 0; y < h; ++y) {
+        sum += row_integral[y];
+        marginal[y + 1] = sum;
+    }
+    f_integral = sum;
+    for (uint32_t y = 1; y <= h; ++y)
+        marginal[y] = sum > 0 ? float(marginal[y] / sum) : y / float(h);
+    marginal[h] = 1.f;
 }
 
+Distribution2D::~Distribution2D() {}
+
 double Distribution2D::integral() const {
-    return 1.f;
+    return f_integral;
 }
 
 double Distribution2D::unit_integral() const {
-    return 1.f;
+    return f_integral / (double(w) * h);
 }
 
 std::tuple<glm::vec2, float> Distribution2D::sample_01(const glm::vec2& sample) const {
-    return { sample, 1.f };
+    assert(sample.x >= 0 && sample.x < 1); assert(sample.y >= 0 && sample.y < 1);
+    // sample row from marginal
+    const uint32_t y = find_interval(marginal, h, sample.y);
+    const float height = marginal[y + 1] - marginal[y];
+    const float dv = height > 0 ? (sample.y - marginal[y]) / height : 0.f;
+    // sample column from conditional of that row
+    const float* cdf = conditional + size_t(y) * (w + 1);
+    const uint32_t x = find_interval(cdf, w, sample.x);
+    const float width = cdf[x + 1] - cdf[x];
+    const float du = width > 0 ? (sample.x - cdf[x]) / width : 0.f;
+    const glm::vec2 uv = glm::min(glm::vec2((x + du) / w, (y + dv) / h), glm::vec2(0x1.fffffep-1f));
+    if (f_integral <= 0) return { uv, 1.f };
+    return { uv, float(func[size_t(y) * w + x] / unit_integral()) };
 }
 
 float Distribution2D::pdf(const glm::vec2& sample) const {
-    throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+    if (f_integral <= 0) return 1.f;
+    const uint32_t x = std::min(uint32_t(glm::max(sample.x, 0.f) * w), w - 1);
+    const uint32_t y = std::min(uint32_t(glm::max(sample.y, 0.f) * h), h - 1);
+    return float(func[size_t(y) * w + x] / unit_integral());
 }
 
 // ----------------------------------------------------
@@ -179,3 +346,31 @@ void debug_distributions() {
         plot_heatmap(dist, W, H);
     }
 }
+
+void benchmark_distributions() {
+    const uint32_t M = 1 << 22;
+    UniformSampler1D sampler;
+    sampler.init(M);
+    std::vector<float> samples(M);
+    for (uint32_t i = 0; i < M; ++i)
+        samples[i] = sampler.next();
+    for (uint32_t N : { 1u << 10, 1u << 16, 1u << 20, 1u << 24 }) {
+        std::vector<float> values(N);
+        for (uint32_t i = 0; i < N; ++i)
+            values[i] = powf(RNG::uniform<float>(), 4);
+        for (auto backend : { Distribution1D::CDF, Distribution1D::ALIAS }) {
+            const std::string name = std::string(backend == Distribution1D::CDF ? "cdf" : "alias") + ", N = " + std::to_string(N);
+            Timer timer;
+            timer.start("build");
+            Distribution1D dist(values.data(), N, backend);
+            timer.stop("build");
+            uint64_t checksum = 0;
+            timer.start("sample");
+            for (uint32_t i = 0; i < M; ++i)
+                checksum += std::get<0>(dist.sample_index(samples[i]));
+            timer.stop("sample");
+            std::cout << name << ": build " << timer.get_ms("build") << "ms, " << M << " samples " << timer.get_ms("sample") << "ms"
+                << ", " << dist.nbytes() / 1024 << "KiB (checksum " << checksum << ")" << std::endl;
+        }
+    }
+}
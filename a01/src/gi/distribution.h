@@ -4,23 +4,104 @@
 #include <vector>
 #include <memory>
 #include <cstdint>
+#include <cassert>
+#include <algorithm>
 #include <glm/glm.hpp>
 
+class MappedFile;
+
+/**
+ * @brief Alias table (Walker/Vose) for O(1) importance sampling of an arbitrary discrete 1D function
+ */
+class AliasTable {
+public:
+    /**
+     * @brief Construct from array of function values
+     * @note Normalization and classification run in parallel, the pairing sweep is a single O(N) pass.
+     *
+     * @param f function values
+     * @param N function length
+     */
+    AliasTable(const float* f, uint32_t N);
+
+    inline uint32_t size() const { return bins.size(); }
+    inline size_t nbytes() const { return bins.size() * sizeof(Bin); }
+
+    /**
+     * @brief Compute absolute integral over the discrete function
+     *
+     * @return Absolute integral over function values
+     */
+    inline double integral() const { return f_integral; }
+
+    /**
+     * @brief Compute discrete PDF for given sample
+     *
+     * @param index Discrete sample drawn from this distribution in [0, N)
+     *
+     * @return PDF of discrete sample
+     */
+    inline float pdf(uint32_t index) const { assert(index < size()); return bins[index].pdf; }
+
+    /**
+     * @brief Compute an importance sampled index in [0, N) from an uniform sample
+     *
+     * @param sample Uniform random sample in [0, 1)
+     *
+     * @return Tuple consisting of:
+     *      - Importance sampled index in [0, N) (uint)
+     *      - PDF of sampled index (float)
+     *      - Unused part of the sample, remapped to [0, 1) for reuse (float)
+     */
+    inline std::tuple<uint32_t, float, float> sample_index(float sample) const {
+        assert(sample >= 0 && sample < 1);
+        const float scaled = sample * size();
+        const uint32_t i = std::min(uint32_t(scaled), size() - 1);
+        const float frac = scaled - i;
+        const Bin& bin = bins[i];
+        if (frac < bin.q)
+            return { i, bin.pdf, std::min(frac / bin.q, ONE_MINUS_EPS) };
+        return { bin.alias, bin.alias_pdf, std::min((frac - bin.q) / (1.f - bin.q), ONE_MINUS_EPS) };
+    }
+
+private:
+    static constexpr float ONE_MINUS_EPS = 0x1.fffffep-1;
+
+    struct Bin {
+        float q;            ///< Probability of keeping this bin
+        uint32_t alias;     ///< Alias index, if not kept
+        float pdf;          ///< PDF of this bin
+        float alias_pdf;    ///< PDF of the alias bin (avoids a dependent load)
+    };
+
+    // data
+    std::vector<Bin> bins;
+    double f_integral;
+};
+
 /**
  * @brief 1D distribution for importance sampling an arbitrary discrete 1D function
  */
 class Distribution1D {
 public:
+    /**
+     * @brief Sampling backend: CDF inversion via binary search in O(log N) or alias table in O(1)
+     */
+    enum Backend { CDF, ALIAS };
+
     /**
      * @brief Construct from array of function values
+     * @note Construction is parallelized and vectorized for large N.
      *
      * @param f function values
      * @param n function length
+     * @param backend Sampling backend
      */
-    Distribution1D(const float *f, uint32_t N);
+    Distribution1D(const float *f, uint32_t N, Backend backend = CDF);
 
     inline float f(size_t i) const { assert(i < size()); return func[i]; }
     inline uint32_t size() const { return func.size(); }
+    inline size_t nbytes() const { return (func.size() + cdf.size()) * sizeof(float) + (alias ? alias->nbytes() : 0); }
 
     /**
      * @brief Compute absolute integral over the discrete function
@@ -78,7 +159,8 @@ public:
 
 private:
     // data
-    std::vector<float> func, cdf;
+    std::vector<float> func, cdf;           ///< Function values and normalized CDF (CDF backend only)
+    std::shared_ptr<const AliasTable> alias; ///< Alias table (alias backend only)
     double f_integral;
 };
 
@@ -97,6 +179,9 @@ public:
     Distribution2D(const float* func, uint32_t w, uint32_t h);
     ~Distribution2D();
 
+    Distribution2D(const Distribution2D&)            = delete;
+    Distribution2D& operator=(const Distribution2D&) = delete;
+
     /**
      * @brief Query integral of function
      *
@@ -125,13 +210,48 @@ public:
      */
     float pdf(const glm::vec2& sample) const;
 
+    inline glm::uvec2 dim() const { return glm::uvec2(w, h); }
+    // resident bytes (mapped tables are shared page cache and not accounted for)
+    inline size_t nbytes() const { return storage.size() * sizeof(float); }
+    // number of floats of all tables for the given dimensions
+    static inline size_t table_size(uint32_t w, uint32_t h) { return size_t(w) * h + size_t(w + 1) * h + h + 1; }
+
 private:
+    friend class EnvmapCache;
+
+    // construct empty, tables are mapped by EnvmapCache
+    Distribution2D() : w(0), h(0), func(nullptr), conditional(nullptr), marginal(nullptr), f_integral(0) {}
+
+    /**
+     * @brief Branch-free binary search in a normalized CDF
+     *
+     * @param cdf CDF values (n + 1 entries, cdf[0] = 0)
+     * @param n Number of intervals
+     * @param u Value in [0, 1)
+     *
+     * @return Index i in [0, n) with cdf[i] <= u < cdf[i + 1]
+     */
+    static inline uint32_t find_interval(const float* cdf, uint32_t n, float u) {
+        const float* base = cdf;
+        for (uint32_t len = n + 1; len > 1; len -= len / 2)
+            base = base[len / 2] <= u ? base + len / 2 : base;
+        return std::min(uint32_t(base - cdf), n - 1);
+    }
+
     // data
+    uint32_t w, h;                  ///< Function dimensions
+    std::vector<float> storage;     ///< Tables in the order below, empty if mapped
+    std::shared_ptr<const MappedFile> mapped; ///< Cache entry holding the tables, see EnvmapCache
+    const float* func;              ///< Absolute function values (w x h, row-major)
+    const float* conditional;       ///< Normalized conditional CDFs per row, stored contiguously ((w + 1) x h)
+    const float* marginal;          ///< Normalized marginal CDF over rows (h + 1)
+    double f_integral;              ///< Absolute integral over function values
 };
 
 // ----------------------------------------------------
 // Debug utilities
 
 void debug_distributions();
+void benchmark_distributions();
 void plot_histogram(const Distribution1D& dist);
 void plot_heatmap(const Distribution2D& dist, uint32_t w, uint32_t h);
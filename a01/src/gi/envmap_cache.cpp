@@ -0,0 +1,180 @@
+#include "envmap_cache.h"
+#include "mapped_file.h"
+#include "asset_cache.h"
+#include "distribution.h"
+#include "texture.h"
+#include "packing.h"
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+static constexpr uint32_t ENVMAP_CACHE_VERSION = 3;
+
+struct EnvmapCacheHeader {
+    char magic[8];      ///< "GIENVMAP"
+    uint32_t version;   ///< File format version
+    uint32_t w, h;      ///< Envmap dimensions
+    uint32_t key_len;   ///< Length of the key of the source file (path, modification time and size)
+    double integral;    ///< Integral of the distribution
+    // followed by: key (key_len chars, zero padded to 8 bytes), texels (w * h RGB9E5),
+    // func (w * h float), conditional ((w + 1) * h float), marginal (h + 1 float)
+};
+
+// offset of the texels, the key is padded to keep them and the tables aligned
+inline size_t texel_offset(size_t key_len) {
+    return sizeof(EnvmapCacheHeader) + (key_len + 7) / 8 * 8;
+}
+
+inline size_t entry_size(size_t key_len, uint32_t w, uint32_t h) {
+    return texel_offset(key_len) + size_t(w) * h * sizeof(uint32_t) + Distribution2D::table_size(w, h) * sizeof(float);
+}
+
+// FNV-1a, stable across builds and standard libraries (unlike std::hash)
+inline uint64_t fnv1a(const std::string& str) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char c : str)
+        hash = (hash ^ uint8_t(c)) * 0x100000001b3ull;
+    return hash;
+}
+
+// -------------------------------------------
+// EnvmapCache
+
+std::tuple<std::shared_ptr<Texture>, std::shared_ptr<Distribution2D>> EnvmapCache::fetch(const std::filesystem::path& path,
+        const std::function<std::shared_ptr<Distribution2D>(const Texture&)>& build) {
+    std::shared_ptr<Distribution2D> dist;
+    const auto [tex, cached] = texture_cache().get(AssetKey(path, TEXTURE_ENVMAP), [&]() {
+        const std::string key = entry_key(path);
+        const std::filesystem::path entry = entry_path(key);
+        if (auto [mapped_tex, mapped_dist] = read(entry, key); mapped_tex && mapped_dist) {
+            dist = mapped_dist;
+            mapped_tex->src_path = path;
+            return mapped_tex;
+        }
+        // miss: decode and pack into the stored format, build the distribution from the packed texels
+        const Texture decoded(path);
+        auto packed = std::make_shared<Texture>();
+        packed->w = decoded.w;
+        packed->h = decoded.h;
+        packed->format = Texture::RGB9E5;
+        packed->src_path = path;
+        packed->raw.resize(size_t(decoded.w) * decoded.h * sizeof(uint32_t));
+        #pragma omp parallel for
+        for (int64_t i = 0; i < int64_t(decoded.w) * decoded.h; ++i) {
+            const uint32_t texel = encode_rgb9e5(decoded.fetch(glm::uvec2(i % decoded.w, i / decoded.w)));
+            memcpy(packed->raw.data() + i * sizeof(uint32_t), &texel, sizeof(uint32_t));
+        }
+        dist = build(*packed);
+        // store for the next time and use the mapped entry right away, s.t. other processes share its pages
+        if (write(entry, key, *packed, *dist)) {
+            if (auto [mapped_tex, mapped_dist] = read(entry, key); mapped_tex && mapped_dist) {
+                dist = mapped_dist;
+                mapped_tex->src_path = path;
+                return mapped_tex;
+            }
+        }
+        return packed;
+    });
+    if (cached) {
+        // the texture was served from the texture cache, its mapping holds the distribution as well
+        if (tex->mapped)
+            dist = map_distribution(tex->mapped, entry_key(path));
+        if (!dist)
+            dist = build(*tex);
+    }
+    return { tex, dist };
+}
+
+std::string EnvmapCache::entry_key(const std::filesystem::path& path) {
+    std::error_code ec;
+    const std::filesystem::path canonical = std::filesystem::weakly_canonical(path, ec);
+    const auto mtime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+    const auto size = std::filesystem::file_size(path, ec);
+    return canonical.string() + "|" + std::to_string(mtime) + "|" + std::to_string(size);
+}
+
+std::filesystem::path EnvmapCache::entry_path(const std::string& key) {
+    std::error_code ec;
+    const std::filesystem::path dir = DIR.empty() ? std::filesystem::temp_directory_path(ec) / "gi_envmap_cache" : std::filesystem::path(DIR);
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.envmap", (unsigned long long)fnv1a(key));
+    return dir / name;
+}
+
+std::tuple<std::shared_ptr<Texture>, std::shared_ptr<Distribution2D>> EnvmapCache::read(const std::filesystem::path& entry, const std::string& key) {
+    auto file = std::make_shared<MappedFile>(entry, true);
+    std::shared_ptr<Distribution2D> dist = map_distribution(file, key);
+    if (!dist) return { nullptr, nullptr };
+    // texels are used in place (RGB9E5), SkyLight::commit() converts if configured otherwise
+    auto tex = std::make_shared<Texture>();
+    tex->w = dist->w;
+    tex->h = dist->h;
+    tex->format = Texture::RGB9E5;
+    tex->mapped = file;
+    tex->mapped_offset = texel_offset(key.size());
+    return { tex, dist };
+}
+
+std::shared_ptr<Distribution2D> EnvmapCache::map_distribution(const std::shared_ptr<MappedFile>& file, const std::string& key) {
+    if (!*file || file->size() < sizeof(EnvmapCacheHeader)) return nullptr;
+    EnvmapCacheHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    // compare the full key, entries with colliding file names are rejected
+    if (memcmp(header.magic, "GIENVMAP", 8) != 0 || header.version != ENVMAP_CACHE_VERSION || header.key_len != key.size() ||
+            header.w == 0 || header.h == 0 || file->size() != entry_size(key.size(), header.w, header.h) ||
+            memcmp(file->data() + sizeof(EnvmapCacheHeader), key.data(), key.size()) != 0)
+        return nullptr;
+    const uint32_t w = header.w, h = header.h;
+    std::shared_ptr<Distribution2D> dist(new Distribution2D());
+    dist->w = w;
+    dist->h = h;
+    dist->f_integral = header.integral;
+    dist->mapped = file;
+    dist->func = (const float*)(file->data() + texel_offset(key.size()) + size_t(w) * h * sizeof(uint32_t));
+    dist->conditional = dist->func + size_t(w) * h;
+    dist->marginal = dist->conditional + size_t(w + 1) * h;
+    return dist;
+}
+
+bool EnvmapCache::write(const std::filesystem::path& entry, const std::string& key, const Texture& tex, const Distribution2D& dist) {
+    if (dist.w != tex.w || dist.h != tex.h || tex.format != Texture::RGB9E5) return false;
+    std::error_code ec;
+    std::filesystem::create_directories(entry.parent_path(), ec);
+    // write to a temporary file and rename, so concurrent readers never see partial entries
+    const std::filesystem::path tmp = entry.string() + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if (!out) {
+            std::cerr << "Warning: EnvmapCache: unable to write cache entry: " << tmp << std::endl;
+            return false;
+        }
+        EnvmapCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "GIENVMAP", 8);
+        header.version = ENVMAP_CACHE_VERSION;
+        header.w = tex.w;
+        header.h = tex.h;
+        header.key_len = key.size();
+        header.integral = dist.f_integral;
+        out.write((const char*)&header, sizeof(header));
+        std::vector<char> padded(texel_offset(key.size()) - sizeof(header), 0);
+        memcpy(padded.data(), key.data(), key.size());
+        out.write(padded.data(), padded.size());
+        out.write((const char*)tex.raw_data(), tex.w * tex.h * sizeof(uint32_t));
+        out.write((const char*)dist.func, Distribution2D::table_size(dist.w, dist.h) * sizeof(float));
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp, entry, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <tuple>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <filesystem>
+
+class Texture;
+class MappedFile;
+class Distribution2D;
+
+/**
+ * @brief Persistent on-disk cache of decoded environment maps and their importance sampling tables
+ * @note Entries are keyed by path, modification time and file size, thus independent of light intensity. The full key
+ * is stored in and compared against each entry, its (stable) hash only names the file.
+ * Texels are stored as RGB9E5 and the distribution is built from these stored texels. Entries are mapped
+ * into memory and used in place, i.e. processes share their pages, and within a process the environment map
+ * is shared through the texture cache.
+ */
+class EnvmapCache {
+public:
+    /**
+     * @brief Fetch decoded environment map and distribution from the disk cache, or build and store them on a miss
+     *
+     * @param path Resolved path to the environment map
+     * @param build Callable building the importance sampling distribution for a texture, invoked on a cache miss
+     *
+     * @return Tuple consisting of:
+     *      - Environment map (std::shared_ptr<Texture>)
+     *      - Importance sampling distribution (std::shared_ptr<Distribution2D>)
+     */
+    static std::tuple<std::shared_ptr<Texture>, std::shared_ptr<Distribution2D>> fetch(const std::filesystem::path& path,
+            const std::function<std::shared_ptr<Distribution2D>(const Texture&)>& build);
+
+    // settings
+    inline static bool ENABLED = true;              ///< Use the on-disk cache when loading environment maps
+    inline static std::string DIR = "";             ///< Cache directory (empty: system temp directory)
+
+private:
+    // key of a source file (path, modification time and size) and location of its entry
+    static std::string entry_key(const std::filesystem::path& path);
+    static std::filesystem::path entry_path(const std::string& key);
+    // map an entry, the texture and the distribution refer to the mapping
+    static std::tuple<std::shared_ptr<Texture>, std::shared_ptr<Distribution2D>> read(const std::filesystem::path& entry, const std::string& key);
+    // distribution within a mapped entry, nullptr if the mapping holds no valid entry
+    static std::shared_ptr<Distribution2D> map_distribution(const std::shared_ptr<MappedFile>& file, const std::string& key);
+    static bool write(const std::filesystem::path& entry, const std::string& key, const Texture& tex, const Distribution2D& dist);
+};
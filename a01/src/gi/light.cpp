@@ -4,17 +4,37 @@
 #include "texture.h"
 #include "buffer.h"
 #include "mesh.h"
+#include "shape.h"
 #include "material.h"
 #include "sampling.h"
 #include "distribution.h"
 #include "timer.h"
 #include "color.h"
+#include "asset_cache.h"
+#include "envmap_cache.h"
+#include "packing.h"
+#include "rng.h"
 #include <iostream>
 
 // ------------------------------------------------
 // Mesh area light
 
-AreaLight::AreaLight(const Mesh& mesh) : mesh(mesh) {}
+AreaLight::AreaLight(const Mesh& mesh) : mesh(mesh) {
+    geometry_bounds.bb_min = mesh.bb_min;
+    geometry_bounds.bb_max = mesh.bb_max;
+    geometry_bounds.two_sided = true; // emission is not restricted to the front side (see SurfaceInteraction::Le)
+    // normal cone around the mean vertex normal
+    glm::vec3 sum(0);
+    for (uint32_t i = 0; i < mesh.num_vertices(); ++i)
+        sum += mesh.normal(i);
+    if (glm::dot(sum, sum) <= 1e-8f) {
+        geometry_bounds.cos_theta_o = -1.f;
+        return;
+    }
+    geometry_bounds.axis = glm::normalize(sum);
+    for (uint32_t i = 0; i < mesh.num_vertices(); ++i)
+        geometry_bounds.cos_theta_o = fminf(geometry_bounds.cos_theta_o, glm::dot(geometry_bounds.axis, mesh.normal(i)));
+}
 
 std::tuple<glm::vec3, Ray, float> AreaLight::sample_Li(const SurfaceInteraction& hit, const glm::vec2& sample) const {
     assert(sample.x >= 0 && sample.x < 1); assert(sample.y >= 0 && sample.y < 1);
@@ -25,47 +45,141 @@ std::tuple<glm::vec3, Ray, float> AreaLight::sample_Li(const SurfaceInteraction&
     // compute the irradiance that arrives at <hit> (shading point) from <light> (point on light source)
     // additionally setup a shadow ray between the two surfaces
     // hint: see surface.h for relevant members of the SurfaceInteraction class
-    // hint: you may simply ignore the sample_pdf variable for now
 
-    glm::vec3 omega_i = glm::normalize(hit.P - light.P);
-    glm::vec3 n = hit.N;
+    const glm::vec3 to_light = light.P - hit.P;
+    const float dist = glm::length(to_light);
+    const glm::vec3 w_i = to_light / dist;
+    // triangles are selected proportional to their emission, convert the selection pdf to area, then to solid angle measure
+    const float cos_light = fabsf(glm::dot(light.N, -w_i));
+    if (cos_light <= 0.f || sample_pdf <= 0.f || light.area <= 0.f) return { glm::vec3(0), Ray(hit.P, w_i, dist), 0.f };
+    const float pdf = sample_pdf / light.area * sqr(dist) / cos_light;
+    return { light.Le() / pdf, Ray(hit.P, w_i, dist), pdf };
+}
 
-    float dot_prod = -glm::dot((omega_i), n);
+float AreaLight::pdf_Li(const SurfaceInteraction& light, const Ray& ray) const {
+    throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+}
 
-    if(dot_prod < 0.0f){
+std::tuple<glm::vec3, Ray, glm::vec3, float, float> AreaLight::sample_Le(const glm::vec2& sample_pos, const glm::vec2& sample_dir) const {
+    throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+}
 
-        dot_prod = 0.0f;
+std::tuple<float, float> AreaLight::pdf_Le(const SurfaceInteraction& light, const glm::vec3& dir) const {
+    throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+}
 
-    }
+glm::vec3 AreaLight::power() const {
+    if (mesh.emission_sampler)
+        return mesh.mat->emissive_strength * mesh.emission_integral * PI;
+    return glm::vec3(mesh.mat->emissive_strength * mesh.surface_area() * PI);
+}
 
-    float area_light = light.area;
+std::tuple<glm::vec3, glm::vec3, glm::vec3, float> AreaLight::sample_point(const glm::vec2& sample) const {
+    const auto [light, pdf_tri] = mesh.sample(sample);
+    // triangle selection pdf to area measure
+    return { light.P, light.N, light.Le(), pdf_tri / fmaxf(light.area, 1e-10f) };
+}
 
-    glm::vec3 k_e = power();
-    float r = glm::length(hit.P - light.P);
+LightBounds AreaLight::bounds() const {
+    LightBounds b = geometry_bounds;
+    b.power = luma(power());
+    return b;
+}
 
-    glm::vec3 L_i = k_e * (area_light*dot_prod)/(r*r);
+bool AreaLight::may_contribute(const SurfaceInteraction& hit) const {
+    return geometry_bounds.may_contribute(hit.P, hit.is_type(BRDF_TRANSMISSION) ? glm::vec3(0) : hit.N);
+}
 
+// ------------------------------------------------
+// Analytic shape light
+
+ShapeLight::ShapeLight(const Shape& shape) : shape(shape) {
+    geometry_bounds.bb_min = shape.bb_min;
+    geometry_bounds.bb_max = shape.bb_max;
+    if (shape.type == Shape::SPHERE)
+        geometry_bounds.cos_theta_o = -1.f;
+    else
+        geometry_bounds.axis = shape.normal;
+}
 
-    const glm::vec3 Le = L_i;
-    Ray shadow_ray = Ray(hit.P, -omega_i, r);
+std::tuple<glm::vec3, Ray, float> ShapeLight::sample_Li(const SurfaceInteraction& hit, const glm::vec2& sample) const {
+    assert(sample.x >= 0 && sample.x < 1); assert(sample.y >= 0 && sample.y < 1);
+    STAT("sampleLi");
+    if (shape.type == Shape::SPHERE) {
+        const glm::vec3 to_center = shape.pos - hit.P;
+        const float dist2_c = glm::dot(to_center, to_center);
+        if (dist2_c > sqr(shape.radius)) {
+            // uniformly sample the cone of directions subtended by the sphere, i.e. only its visible side
+            const float dist_c = sqrtf(dist2_c);
+            const float sin2_max = sqr(shape.radius) / dist2_c;
+            const float one_minus_cos_max = sin2_max / (1.f + sqrtf(fmaxf(0.f, 1.f - sin2_max)));
+            const float cos_t = 1.f - sample.x * one_minus_cos_max;
+            const float sin_t = sqrtf(fmaxf(0.f, 1.f - sqr(cos_t)));
+            const float phi = 2 * PI * sample.y;
+            const glm::vec3 w_i = align(to_center / dist_c, glm::vec3(sin_t * cosf(phi), sin_t * sinf(phi), cos_t));
+            // distance to the first intersection with the sphere
+            const float dist = dist_c * cos_t - sqrtf(fmaxf(0.f, sqr(shape.radius) - dist2_c * sqr(sin_t)));
+            const SurfaceInteraction light(hit.P + dist * w_i, &shape);
+            const float pdf = 1.f / (2 * PI * one_minus_cos_max);
+            return { light.Le() / pdf, Ray(hit.P, w_i, dist), pdf };
+        }
+    }
+    // uniformly sample a point on the shape
+    const auto [light, pdf_area] = shape.sample(sample);
+    const glm::vec3 to_light = light.P - hit.P;
+    const float dist = glm::length(to_light);
+    const glm::vec3 w_i = to_light / dist;
+    // convert from area to solid angle measure
+    const float cos_light = fabsf(glm::dot(light.N, -w_i));
+    if (cos_light <= 0.f || pdf_area <= 0.f) return { glm::vec3(0), Ray(hit.P, w_i, dist), 0.f };
+    const float pdf = pdf_area * sqr(dist) / cos_light;
+    return { light.Le() / pdf, Ray(hit.P, w_i, dist), pdf };
+}
 
-    return { Le, shadow_ray, sample_pdf };
+float ShapeLight::pdf_Li(const SurfaceInteraction& light, const Ray& ray) const {
+    if (shape.type == Shape::SPHERE) {
+        const glm::vec3 to_center = shape.pos - ray.org;
+        const float dist2_c = glm::dot(to_center, to_center);
+        if (dist2_c > sqr(shape.radius)) {
+            const float sin2_max = sqr(shape.radius) / dist2_c;
+            return 1.f / (2 * PI * sin2_max / (1.f + sqrtf(fmaxf(0.f, 1.f - sin2_max))));
+        }
+    }
+    const float cos_light = fabsf(glm::dot(light.N, -ray.dir));
+    if (cos_light <= 0.f) return 0.f;
+    return sqr(ray.tfar) / (cos_light * shape.surface_area());
 }
 
-float AreaLight::pdf_Li(const SurfaceInteraction& light, const Ray& ray) const {
-    throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+std::tuple<glm::vec3, Ray, glm::vec3, float, float> ShapeLight::sample_Le(const glm::vec2& sample_pos, const glm::vec2& sample_dir) const {
+    const auto [light, pdf_pos] = shape.sample(sample_pos);
+    // cosine distributed direction around the surface normal
+    const glm::vec2 d = concentric_sample_disk(sample_dir);
+    const float cos_t = sqrtf(fmaxf(0.f, 1.f - glm::dot(d, d)));
+    const glm::vec3 dir = align(light.N, glm::vec3(d, cos_t));
+    return { light.Le(), light.spawn_ray(dir), light.N, pdf_pos, cos_t * INVPI };
 }
 
-std::tuple<glm::vec3, Ray, glm::vec3, float, float> AreaLight::sample_Le(const glm::vec2& sample_pos, const glm::vec2& sample_dir) const {
-    throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+std::tuple<float, float> ShapeLight::pdf_Le(const SurfaceInteraction& light, const glm::vec3& dir) const {
+    return { 1.f / shape.surface_area(), fmaxf(0.f, glm::dot(light.N, dir)) * INVPI };
 }
 
-std::tuple<float, float> AreaLight::pdf_Le(const SurfaceInteraction& light, const glm::vec3& dir) const {
-    throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+glm::vec3 ShapeLight::power() const {
+    return glm::vec3(shape.mat->emissive_strength * shape.surface_area() * PI);
 }
 
-glm::vec3 AreaLight::power() const {
-    return glm::vec3(mesh.mat->emissive_strength * mesh.surface_area() * PI);
+std::tuple<glm::vec3, glm::vec3, glm::vec3, float> ShapeLight::sample_point(const glm::vec2& sample) const {
+    const auto [light, pdf] = shape.sample(sample);
+    return { light.P, light.N, light.Le(), pdf };
+}
+
+LightBounds ShapeLight::bounds() const {
+    LightBounds b = geometry_bounds;
+    b.power = luma(power());
+    return b;
+}
+
+bool ShapeLight::may_contribute(const SurfaceInteraction& hit) const {
+    return geometry_bounds.may_contribute(hit.P, hit.is_type(BRDF_TRANSMISSION) ? glm::vec3(0) : hit.N);
 }
 
 // ------------------------------------------------
@@ -82,27 +196,158 @@ void SkyLight::load(const std::filesystem::path& path, const glm::vec3& scene_ce
     // init variables
     const std::filesystem::path resolved_path = std::filesystem::exists(path) ? path : std::filesystem::path(GI_DATA_DIR) / path;
     std::cout << "loading: " << path << " (" << resolved_path << ")..." << std::endl;
-    tex = std::make_shared<Texture>(resolved_path);
+    distribution.reset();
+    oct.reset();
+    cube.reset();
+    if (EnvmapCache::ENABLED)
+        std::tie(tex, distribution) = EnvmapCache::fetch(resolved_path, SkyLight::build_distribution);
+    else
+        tex = load_texture_cached(resolved_path);
     this->intensity = intensity;
     this->scene_center = scene_center;
     this->scene_radius = scene_radius;
 }
 
 void SkyLight::commit() {
-    throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+    assert(tex);
+    if (!distribution || distribution->dim() != tex->dim())
+        distribution = build_distribution(*tex);
+    tex->convert(FORMAT);
+    if (MIPMAPS && tex->levels() == 1)
+        tex->build_mipmaps();
+    if (!OCTAHEDRAL)
+        oct.reset();
+    else if (!oct) {
+        // square map with roughly the texel count of the lat-long map
+        const uint32_t N = 1u << uint32_t(floorf(log2f(fmaxf(1.f, sqrtf(float(tex->width() * tex->height()))))));
+        oct = reproject(*tex, N, N, [N](const glm::vec2& p) { return octahedral_unmap(2.f * p / float(N) - 1.f); });
+    }
+    if (!CUBEMAP)
+        cube.reset();
+    else if (!cube) {
+        // six N x N faces side by side with roughly the texel count of the lat-long map
+        const uint32_t N = 1u << uint32_t(floorf(log2f(fmaxf(1.f, sqrtf(float(tex->width() * tex->height()) / 6.f)))));
+        cube = reproject(*tex, 6 * N, N, [N](const glm::vec2& p) {
+            const uint32_t face = std::min(uint32_t(p.x) / N, 5u);
+            return cubemap_unmap(face, glm::vec2(p.x - face * N, p.y) / float(N));
+        });
+    }
+}
+
+std::shared_ptr<Texture> SkyLight::reproject(const Texture& tex, uint32_t w, uint32_t h, const std::function<glm::vec3(const glm::vec2&)>& unmap) {
+    // 2x2 supersampled lookups of the lat-long map, in parallel over rows
+    std::vector<glm::vec3> texels(size_t(w) * h);
+    #pragma omp parallel for
+    for (int y = 0; y < int(h); ++y) {
+        for (uint32_t x = 0; x < w; ++x) {
+            glm::vec2 uv[4];
+            for (uint32_t s = 0; s < 4; ++s) {
+                const glm::vec3 dir = unmap(glm::vec2(x, y) + glm::vec2(.25f + .5f * (s & 1), .25f + .5f * (s >> 1)));
+                uv[s] = glm::vec2(atan2f(dir.z, dir.x) / (2.f * M_PI), acosf(glm::clamp(dir.y, -1.f, 1.f)) / M_PI);
+            }
+            glm::vec3 L[4];
+            tex.bilin4(uv, L);
+            texels[size_t(y) * w + x] = (L[0] + L[1] + L[2] + L[3]) * .25f;
+        }
+    }
+    auto result = std::make_shared<Texture>(w, h, texels.data());
+    result->convert(FORMAT);
+    if (MIPMAPS) result->build_mipmaps();
+    return result;
+}
+
+std::shared_ptr<Distribution2D> SkyLight::build_distribution(const Texture& tex) {
+    // luminance weighted by sin(theta) to account for the distortion of the lat-long parameterization
+    const uint32_t w = tex.width(), h = tex.height();
+    std::vector<float> func(size_t(w) * h);
+    #pragma omp parallel for
+    for (int y = 0; y < int(h); ++y) {
+        const float sin_t = sinf(PI * (y + .5f) / h);
+        for (uint32_t x = 0; x < w; ++x)
+            func[size_t(y) * w + x] = luma(tex.fetch(glm::uvec2(x, y))) * sin_t;
+    }
+    return std::make_shared<Distribution2D>(func.data(), w, h);
 }
 
 std::tuple<glm::vec3, Ray, float> SkyLight::sample_Li(const SurfaceInteraction& hit, const glm::vec2& sample) const {
-    throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+    assert(sample.x >= 0 && sample.x < 1); assert(sample.y >= 0 && sample.y < 1);
+    assert(tex && distribution);
+    STAT("sampleLi");
+    // importance sample the environment map in its lat-long parameterization
+    const auto [uv, pdf_uv] = distribution->sample_01(sample);
+    const float theta = uv.y * PI, phi = uv.x * 2 * PI;
+    const float sin_t = sinf(theta);
+    if (pdf_uv <= 0.f || sin_t <= 0.f) return { glm::vec3(0), Ray(hit.P, hit.N), 0.f };
+    const glm::vec3 w_i = glm::vec3(sin_t * cosf(phi), cosf(theta), sin_t * sinf(phi));
+    // convert from (u, v) to solid angle measure
+    const float pdf = pdf_uv / (2 * PI * PI * sin_t);
+    const Ray ray(hit.P, w_i);
+    return { Le(ray) / pdf, ray, pdf };
 }
 
 float SkyLight::pdf_Li(const SurfaceInteraction& light, const Ray& ray) const {
-    throw std::runtime_error("Function not implemented: " + std::string(__FILE__) + ", line: " + std::to_string(__LINE__));
+    assert(distribution);
+    const glm::vec2 theta_phi = to_spherical(ray.dir);
+    const float sin_t = sinf(theta_phi.x);
+    if (sin_t <= 0.f) return 0.f;
+    return distribution->pdf(glm::vec2(theta_phi.y / (2 * PI), theta_phi.x / PI)) / (2 * PI * PI * sin_t);
+}
+
+std::tuple<glm::vec3, glm::vec3, glm::vec3, float> SkyLight::sample_point(const glm::vec2& sample) const {
+    assert(tex && distribution);
+    const auto [uv, pdf_uv] = distribution->sample_01(sample);
+    const float theta = uv.y * PI, phi = uv.x * 2 * PI;
+    const float sin_t = sinf(theta);
+    const glm::vec3 w_i = glm::vec3(sin_t * cosf(phi), cosf(theta), sin_t * sinf(phi));
+    if (pdf_uv <= 0.f || sin_t <= 0.f) return { w_i, -w_i, glm::vec3(0), 0.f };
+    return { w_i, -w_i, tex->env(w_i) * intensity, pdf_uv / (2 * PI * PI * sin_t) };
 }
 
 glm::vec3 SkyLight::Le(const Ray& ray) const {
+    return Le(ray, 0.f);
+}
+
+glm::vec3 SkyLight::Le(const Ray& ray, float spread) const {
     assert(tex && distribution);
-    return tex->env(ray.dir) * intensity;
+    if (cube) {
+        STAT("Texture lookup");
+        // texel angular width of the cube map is about (pi / 2) / N
+        const uint32_t N = cube->height();
+        const float lod = spread > 0.f ? log2f(spread * N / (.5f * PI)) : 0.f;
+        uint32_t face;
+        const glm::vec2 st = cubemap_map(ray.dir, face);
+        // clamp per level to the face, lookups must not blend across face borders
+        auto lookup = [&](size_t l) {
+            const Texture& level = cube->level(l);
+            const float half_texel = .5f / level.height();
+            const glm::vec2 p = glm::clamp(st, half_texel, 1.f - half_texel);
+            return level.bilin(glm::vec2((face + p.x) / 6.f, p.y));
+        };
+        if (lod <= 0.f || cube->levels() == 1) return lookup(0) * intensity;
+        // stop at 1x1 faces, coarser levels merge neighbouring faces
+        const float l = fminf(lod, fminf(log2f(N), float(cube->levels() - 1)));
+        const float f = l - floorf(l);
+        return glm::mix(lookup(size_t(l)), lookup(size_t(l) + 1), f) * intensity;
+    }
+    if (oct) {
+        STAT("Texture lookup");
+        // texel angular width of the octahedral map is about sqrt(4 pi) / N
+        const float lod = spread > 0.f ? log2f(spread * oct->width() / sqrtf(4 * PI)) : 0.f;
+        const glm::vec2 uv = octahedral_map(ray.dir) * .5f + .5f;
+        // clamp per level: the borders of the octahedral map fold instead of wrapping around
+        auto lookup = [&](size_t l) {
+            const Texture& level = oct->level(l);
+            const glm::vec2 half_texel = .5f / glm::vec2(level.dim());
+            return level.bilin(glm::clamp(uv, half_texel, 1.f - half_texel));
+        };
+        if (lod <= 0.f || oct->levels() == 1) return lookup(0) * intensity;
+        const float l = fminf(lod, float(oct->levels() - 1));
+        const float f = l - floorf(l);
+        return glm::mix(lookup(size_t(l)), lookup(size_t(l) + 1), f) * intensity;
+    }
+    // texel angular width of the lat-long map at the equator is 2 pi / w
+    const float lod = spread > 0.f ? log2f(spread * tex->width() / (2 * PI)) : 0.f;
+    return tex->env(ray.dir, lod) * intensity;
 }
 
 std::tuple<glm::vec3, Ray, glm::vec3, float, float> SkyLight::sample_Le(const glm::vec2& sample_pos, const glm::vec2& sample_dir) const {
@@ -141,8 +386,58 @@ void SkyLight::from_json(const json11::Json& cfg) {
         json_set_float(cfg, "scene_radius", scene_radius);
         if (cfg["envmap"].is_string())
             load(cfg["envmap"].string_value(), scene_center, scene_radius, intensity);
-        else
+        else {
             tex = std::make_shared<Texture>(glm::vec3(1));
+            distribution.reset();
+            oct.reset();
+            cube.reset();
+        }
         commit();
     }
 }
+
+// ------------------------------------------------
+// Debugging
+
+void debug_envmap_lookups(const SkyLight& sky, uint32_t num_directions) {
+    // variants of the light with and without re-projections, sharing the lat-long map
+    const bool octahedral = SkyLight::OCTAHEDRAL, cubemap = SkyLight::CUBEMAP;
+    SkyLight latlong = sky, oct = sky, cube = sky;
+    latlong.oct.reset(); latlong.cube.reset();
+    oct.cube.reset();
+    SkyLight::OCTAHEDRAL = true;
+    SkyLight::CUBEMAP = false;
+    oct.commit();
+    SkyLight::CUBEMAP = true;
+    cube.commit();
+    SkyLight::OCTAHEDRAL = octahedral;
+    SkyLight::CUBEMAP = cubemap;
+    // incoherent directions, uniform over the sphere
+    std::vector<glm::vec3> dirs(num_directions);
+    #pragma omp parallel for
+    for (int i = 0; i < int(num_directions); ++i) {
+        const glm::vec2 sample = RNG::uniform<glm::vec2>();
+        const float z = 1.f - 2.f * sample.x, r = sqrtf(fmaxf(0.f, 1.f - z * z)), phi = 2 * PI * sample.y;
+        dirs[i] = glm::vec3(r * cosf(phi), r * sinf(phi), z);
+    }
+    std::vector<glm::vec3> reference(num_directions), result(num_directions);
+    Timer timer;
+    auto run = [&](const std::string& name, const SkyLight& light, std::vector<glm::vec3>& out) {
+        timer.start(name);
+        #pragma omp parallel for
+        for (int i = 0; i < int(num_directions); ++i)
+            out[i] = light.Le(Ray(glm::vec3(0), dirs[i]));
+        timer.stop(name);
+    };
+    run("lat-long", latlong, reference);
+    std::cout << "Envmap lookups (" << sky.tex->path() << ", " << num_directions << " directions): lat-long: "
+        << timer.get_ms("lat-long") << "ms";
+    for (const auto& [name, light] : { std::make_pair("octahedral", &oct), std::make_pair("cube map", &cube) }) {
+        run(name, *light, result);
+        double rel_error = 0;
+        for (size_t i = 0; i < num_directions; ++i)
+            rel_error += luma(glm::abs(result[i] - reference[i])) / fmaxf(1e-4f, luma(reference[i]));
+        std::cout << ", " << name << ": " << timer.get_ms(name) << "ms (avg rel error: " << rel_error / std::max(1u, num_directions) << ")";
+    }
+    std::cout << std::endl;
+}
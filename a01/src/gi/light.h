@@ -4,15 +4,65 @@
 #include "texture.h"
 #include "distribution.h"
 #include <tuple>
+#include <cfloat>
 #include <string>
 #include <memory>
+#include <functional>
 #include <filesystem>
 
 class Ray;
 class Mesh;
+class Shape;
 class Scene;
 class SurfaceInteraction;
 
+/**
+ * @brief Spatial and directional bounds of a light source or a cluster of light sources (Conty and Kulla 2018)
+ */
+struct LightBounds {
+    LightBounds() : bb_min(FLT_MAX), bb_max(-FLT_MAX), axis(0, 0, 1), cos_theta_o(1), cos_theta_e(0), power(0), two_sided(false) {}
+
+    inline bool valid() const { return power > 0.f; }
+    inline glm::vec3 centroid() const { return (bb_min + bb_max) * .5f; }
+
+    /**
+     * @brief Merge two bounds, i.e. union of boxes and normal cones and sum of powers
+     *
+     * @return Merged bounds
+     */
+    static LightBounds merge(const LightBounds& a, const LightBounds& b);
+
+    /**
+     * @brief Conservatively estimate the contribution of the bounded light source(s) to a shading point
+     *
+     * @param P Shading point
+     * @param N Shading normal (or zero to ignore the cosine at the shading point)
+     *
+     * @return Unnormalized importance, zero if the light source(s) cannot contribute
+     */
+    float importance(const glm::vec3& P, const glm::vec3& N) const;
+
+    /**
+     * @brief Cheap conservative test if the bounded light source(s) may illuminate a shading point
+     * @note Rejects light sources behind the tangent plane of the shading point or facing away from it.
+     *
+     * @param P Shading point
+     * @param N Shading normal (or zero to skip the tangent plane test, e.g. for transmissive surfaces)
+     *
+     * @return false if the light source(s) certainly do not contribute, true otherwise
+     */
+    bool may_contribute(const glm::vec3& P, const glm::vec3& N) const;
+
+    // data
+    glm::vec3 bb_min;       ///< AABB (lower left corner)
+    glm::vec3 bb_max;       ///< AABB (upper right corner)
+    glm::vec3 axis;         ///< Normal cone axis
+    float cos_theta_o;      ///< Cosine of normal cone half angle
+    float cos_theta_e;      ///< Cosine of emission spread around the normals (0 for lambertian emitters)
+    float power;            ///< Luminance of emitted power
+    bool two_sided;         ///< Emits on both sides of the surface
+};
+
 /**
  * @brief General light source interface abstracting away the actual type of the light source
  */
@@ -63,6 +113,19 @@ public:
 
     virtual std::tuple<float, float> pdf_Le(const SurfaceInteraction& light, const glm::vec3& dir) const = 0; // currently unused
 
+    /**
+     * @brief Sample a point on the light source independently of a shading point, e.g. for resampling
+     *
+     * @param sample Random samples in [0, 1)
+     *
+     * @return Tuple consisting of:
+     *      - Sampled point on the light source, or direction towards it for infinite light sources (vec3)
+     *      - Surface normal at the sampled point (vec3)
+     *      - Emitted radiance at the sampled point (vec3)
+     *      - PDF of the sample w.r.t. surface area, or solid angle for infinite light sources (float)
+     */
+    virtual std::tuple<glm::vec3, glm::vec3, glm::vec3, float> sample_point(const glm::vec2& sample) const = 0;
+
     /**
      * @brief Compute irradiance for escaped ray
      *
@@ -88,6 +151,23 @@ public:
      */
     virtual bool is_infinite() const = 0;
 
+    /**
+     * @brief Spatial and directional bounds of the light source, used for light source selection per shading point
+     *
+     * @return Bounds of the light source (invalid for infinite light sources)
+     */
+    virtual LightBounds bounds() const { return LightBounds(); }
+
+    /**
+     * @brief Cheap conservative test if the light source may illuminate the given shading point
+     * @note Used to skip back-facing light sources before spending a shadow ray.
+     *
+     * @param hit Shading point
+     *
+     * @return false if the light source certainly does not contribute, true otherwise
+     */
+    virtual bool may_contribute(const SurfaceInteraction& hit) const { return true; }
+
 protected:
     friend class Scene;
     friend class json11::Json;
@@ -98,6 +178,8 @@ protected:
 
 /**
  * @brief Area light source defined via Mesh
+ * @note sample_Li returns radiance divided by its PDF and the PDF w.r.t. solid angle. Triangles are selected
+ * proportional to their (textured) emission, see Mesh::sample, the radiance is the texel emission at the sample.
  */
 class AreaLight : public Light {
 public:
@@ -108,10 +190,13 @@ public:
 
     std::tuple<glm::vec3, Ray, glm::vec3, float, float> sample_Le(const glm::vec2& sample_pos, const glm::vec2& sample_dir) const;
     std::tuple<float, float> pdf_Le(const SurfaceInteraction& light, const glm::vec3& dir) const;
+    std::tuple<glm::vec3, glm::vec3, glm::vec3, float> sample_point(const glm::vec2& sample) const;
 
     glm::vec3 Le(const Ray& ray) const { return glm::vec3(0); }
     glm::vec3 power() const;
     bool is_infinite() const { return false; }
+    LightBounds bounds() const;
+    bool may_contribute(const SurfaceInteraction& hit) const;
 
     // empty json import/export since this is implicitly built
     json11::Json to_json() const { return json11::Json(); }
@@ -119,6 +204,38 @@ public:
 
     // data
     const Mesh& mesh;               ///< mesh representing the light source
+    LightBounds geometry_bounds;    ///< Precomputed bounding box and normal cone (power is filled in on demand)
+};
+
+/**
+ * @brief Area light source defined via an analytic Shape (sphere, disk or quad)
+ * @note sample_Li returns radiance divided by its PDF and the PDF w.r.t. solid angle, as does pdf_Li.
+ * Spheres seen from outside are sampled within the cone they subtend, all other cases uniformly by area.
+ */
+class ShapeLight : public Light {
+public:
+    ShapeLight(const Shape& shape);
+
+    std::tuple<glm::vec3, Ray, float> sample_Li(const SurfaceInteraction& hit, const glm::vec2& sample) const;
+    float pdf_Li(const SurfaceInteraction& light, const Ray& ray) const;
+
+    std::tuple<glm::vec3, Ray, glm::vec3, float, float> sample_Le(const glm::vec2& sample_pos, const glm::vec2& sample_dir) const;
+    std::tuple<float, float> pdf_Le(const SurfaceInteraction& light, const glm::vec3& dir) const;
+    std::tuple<glm::vec3, glm::vec3, glm::vec3, float> sample_point(const glm::vec2& sample) const;
+
+    glm::vec3 Le(const Ray& ray) const { return glm::vec3(0); }
+    glm::vec3 power() const;
+    bool is_infinite() const { return false; }
+    LightBounds bounds() const;
+    bool may_contribute(const SurfaceInteraction& hit) const;
+
+    // empty json import/export since this is implicitly built
+    json11::Json to_json() const { return json11::Json(); }
+    void from_json(const json11::Json& cfg) {}
+
+    // data
+    const Shape& shape;             ///< shape representing the light source
+    LightBounds geometry_bounds;    ///< Precomputed bounding box and normal cone (power is filled in on demand)
 };
 
 /**
@@ -130,18 +247,50 @@ public:
     SkyLight(const std::filesystem::path& path, const Scene& scene, float intensity = 1.f);
 
     void load(const std::filesystem::path& path, const glm::vec3& scene_center, float scene_radius, float intensity = 1.f);
-    void commit(); // build distribution
+    void commit(); // build distribution (if not restored from the envmap cache), mip pyramid and re-projection
+
+    /**
+     * @brief Build the importance sampling distribution for an equirectangular environment map
+     *
+     * @param tex Environment map
+     *
+     * @return Distribution over sin(theta) weighted texel luminance
+     */
+    static std::shared_ptr<Distribution2D> build_distribution(const Texture& tex);
+
+    /**
+     * @brief Re-project an equirectangular environment map into another parameterization
+     *
+     * @param tex Environment map
+     * @param w Width of the re-projection
+     * @param h Height of the re-projection
+     * @param unmap Direction for a position in [0, w] x [0, h]
+     *
+     * @return Re-projected map in FORMAT, mip mapped if MIPMAPS is set
+     */
+    static std::shared_ptr<Texture> reproject(const Texture& tex, uint32_t w, uint32_t h, const std::function<glm::vec3(const glm::vec2&)>& unmap);
 
     std::tuple<glm::vec3, Ray, float> sample_Li(const SurfaceInteraction& hit, const glm::vec2& sample) const;
     float pdf_Li(const SurfaceInteraction& light, const Ray& ray) const;
 
     std::tuple<glm::vec3, Ray, glm::vec3, float, float> sample_Le(const glm::vec2& sample_pos, const glm::vec2& sample_dir) const;
     std::tuple<float, float> pdf_Le(const SurfaceInteraction& light, const glm::vec3& dir) const;
+    std::tuple<glm::vec3, glm::vec3, glm::vec3, float> sample_point(const glm::vec2& sample) const;
 
     glm::vec3 Le(const Ray& ray) const;
     glm::vec3 power() const;
     inline bool is_infinite() const { return true; }
 
+    /**
+     * @brief Prefiltered radiance arriving from the environment along a ray with wide footprint
+     *
+     * @param ray Escaped ray
+     * @param spread Angular width of the ray footprint in radians (e.g. from a rough or diffuse bounce), 0 for full resolution
+     *
+     * @return Radiance, read from the mip level whose texels match the footprint
+     */
+    glm::vec3 Le(const Ray& ray, float spread) const;
+
     json11::Json to_json() const;
     void from_json(const json11::Json& cfg);
 
@@ -149,6 +298,17 @@ public:
     std::shared_ptr<Texture> tex;                   ///< spherical environment map
     float intensity;                                ///< scalar light source intensity
     std::shared_ptr<Distribution2D> distribution;   ///< distribution for importance sampling
+    std::shared_ptr<Texture> oct;                   ///< Octahedral re-projection of the environment map (optional)
+    std::shared_ptr<Texture> cube;                  ///< Cube map re-projection of the environment map, faces side by side (optional)
     glm::vec3 scene_center;                         ///< Center of disk approximation of scene
     float scene_radius;                             ///< Radius of disk approximation of scene
+
+    // settings
+    inline static bool MIPMAPS = true;              ///< Prefilter the environment map for lookups with wide footprints
+    inline static bool OCTAHEDRAL = false;          ///< Look up radiance in an octahedral re-projection (no trigonometry)
+    inline static bool CUBEMAP = false;             ///< Look up radiance in a cube map re-projection (takes precedence over OCTAHEDRAL)
+    inline static Texture::Format FORMAT = Texture::RGB9E5; ///< Texel storage format of environment maps (and their re-projection)
 };
+
+// time lat-long, octahedral and cube map radiance lookups along incoherent directions
+void debug_envmap_lookups(const SkyLight& sky, uint32_t num_directions = 1 << 22);
@@ -0,0 +1,200 @@
+#include "light_tree.h"
+#include "sampling.h"
+#include <cmath>
+#include <cfloat>
+#include <cassert>
+#include <algorithm>
+
+static constexpr float ONE_MINUS_EPS = 0x1.fffffep-1;
+
+// ----------------------------------------------------
+// LightBounds
+
+LightBounds LightBounds::merge(const LightBounds& a, const LightBounds& b) {
+    if (!a.valid()) return b;
+    if (!b.valid()) return a;
+    LightBounds m;
+    m.bb_min = glm::min(a.bb_min, b.bb_min);
+    m.bb_max = glm::max(a.bb_max, b.bb_max);
+    m.power = a.power + b.power;
+    m.cos_theta_e = fminf(a.cos_theta_e, b.cos_theta_e);
+    m.two_sided = a.two_sided || b.two_sided;
+    // union of normal cones
+    const float theta_a = acosf(glm::clamp(a.cos_theta_o, -1.f, 1.f));
+    const float theta_b = acosf(glm::clamp(b.cos_theta_o, -1.f, 1.f));
+    const float theta_d = acosf(glm::clamp(glm::dot(a.axis, b.axis), -1.f, 1.f));
+    if (fminf(theta_d + theta_b, PI) <= theta_a) {
+        m.axis = a.axis;
+        m.cos_theta_o = a.cos_theta_o;
+    } else if (fminf(theta_d + theta_a, PI) <= theta_b) {
+        m.axis = b.axis;
+        m.cos_theta_o = b.cos_theta_o;
+    } else {
+        const float theta_o = (theta_a + theta_d + theta_b) * .5f;
+        const glm::vec3 w_r = glm::cross(a.axis, b.axis);
+        if (theta_o >= PI || glm::dot(w_r, w_r) <= 0.f) {
+            m.axis = a.axis;
+            m.cos_theta_o = -1.f;
+        } else {
+            // rotate a's axis towards b's axis by theta_o - theta_a
+            const float theta_r = theta_o - theta_a;
+            const glm::vec3 k = glm::normalize(w_r);
+            m.axis = glm::normalize(a.axis * cosf(theta_r) + glm::cross(k, a.axis) * sinf(theta_r));
+            m.cos_theta_o = cosf(theta_o);
+        }
+    }
+    return m;
+}
+
+float LightBounds::importance(const glm::vec3& P, const glm::vec3& N) const {
+    if (!valid()) return 0.f;
+    // distance to the box center, clamped to avoid the singularity inside the box
+    const glm::vec3 pc = centroid();
+    const float r2 = glm::dot(bb_max - bb_min, bb_max - bb_min) * .25f;
+    const float dist2 = glm::dot(P - pc, P - pc);
+    const glm::vec3 w_i = dist2 > 0.f ? (P - pc) / sqrtf(dist2) : glm::vec3(0, 0, 1);
+    // angle between the cone axis and the direction to the shading point
+    float cos_w = glm::dot(axis, w_i);
+    if (two_sided) cos_w = fabsf(cos_w);
+    const float sin_w = sin_theta(cos_w);
+    // angle subtended by the bounding sphere of the box
+    const float cos_b = dist2 < r2 ? -1.f : sqrtf(fmaxf(0.f, 1.f - r2 / dist2));
+    const float sin_b = sin_theta(cos_b);
+    // minimal angle between emitter normals and the direction to the shading point
+    const float cos_x = cos_sub_clamped(sin_w, cos_w, sin_theta(cos_theta_o), cos_theta_o);
+    const float cos_p = cos_sub_clamped(sin_theta(cos_x), cos_x, sin_b, cos_b);
+    if (cos_p <= cos_theta_e) return 0.f;
+    float importance = power * cos_p / fmaxf(dist2, r2);
+    // cosine at the shading point
+    if (N != glm::vec3(0)) {
+        const float cos_i = fabsf(glm::dot(w_i, N));
+        importance *= cos_sub_clamped(sin_theta(cos_i), cos_i, sin_b, cos_b);
+    }
+    return fmaxf(importance, 0.f);
+}
+
+bool LightBounds::may_contribute(const glm::vec3& P, const glm::vec3& N) const {
+    // box entirely behind the tangent plane of the shading point
+    const glm::vec3 c = centroid(), half_extent = (bb_max - bb_min) * .5f;
+    if (N != glm::vec3(0) && glm::dot(c - P, N) + glm::dot(half_extent, glm::abs(N)) <= 0.f)
+        return false;
+    // all emitter normals facing away from the shading point
+    if (cos_theta_o <= -1.f) return true;
+    const float r2 = glm::dot(half_extent, half_extent);
+    const float dist2 = glm::dot(P - c, P - c);
+    if (dist2 <= r2) return true;
+    float cos_w = glm::dot(axis, (P - c) / sqrtf(dist2));
+    if (two_sided) cos_w = fabsf(cos_w);
+    const float cos_b = sqrtf(fmaxf(0.f, 1.f - r2 / dist2));
+    const float cos_x = cos_sub_clamped(sin_theta(cos_w), cos_w, sin_theta(cos_theta_o), cos_theta_o);
+    return cos_sub_clamped(sin_theta(cos_x), cos_x, sin_theta(cos_b), cos_b) > cos_theta_e;
+}
+
+// ----------------------------------------------------
+// LightTree
+
+LightTree::LightTree(const std::vector<Light*>& lights) {
+    std::vector<std::tuple<const Light*, LightBounds>> items;
+    for (const Light* light : lights) {
+        if (light->is_infinite())
+            infinite.push_back(light);
+        else {
+            const LightBounds bounds = light->bounds();
+            if (bounds.valid()) items.emplace_back(light, bounds);
+        }
+    }
+    if (!items.empty()) {
+        nodes.reserve(2 * items.size() - 1);
+        finite.reserve(items.size());
+        build(items, 0, items.size(), 0, 0);
+    }
+}
+
+uint32_t LightTree::build(std::vector<std::tuple<const Light*, LightBounds>>& items, uint32_t begin, uint32_t end, uint64_t trail, uint32_t depth) {
+    assert(begin < end && depth < 64);
+    const uint32_t node = nodes.size();
+    nodes.emplace_back();
+    if (end - begin == 1) {
+        const auto& [light, bounds] = items[begin];
+        nodes[node] = Node{ bounds, uint32_t(finite.size()), true };
+        trails[light] = trail;
+        finite.push_back(light);
+        return node;
+    }
+    // split at the median along the largest extent of the centroids
+    glm::vec3 c_min(FLT_MAX), c_max(-FLT_MAX);
+    for (uint32_t i = begin; i < end; ++i) {
+        c_min = glm::min(c_min, std::get<1>(items[i]).centroid());
+        c_max = glm::max(c_max, std::get<1>(items[i]).centroid());
+    }
+    const glm::vec3 extent = c_max - c_min;
+    const int axis = extent.x > extent.y && extent.x > extent.z ? 0 : extent.y > extent.z ? 1 : 2;
+    const uint32_t mid = (begin + end) / 2;
+    std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [axis](const auto& a, const auto& b) {
+        return std::get<1>(a).centroid()[axis] < std::get<1>(b).centroid()[axis];
+    });
+    const uint32_t left = build(items, begin, mid, trail, depth + 1);
+    const uint32_t right = build(items, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+    nodes[node] = Node{ LightBounds::merge(nodes[left].bounds, nodes[right].bounds), right, false };
+    return node;
+}
+
+std::tuple<const Light*, float> LightTree::sample(const glm::vec3& P, const glm::vec3& N, float sample) const {
+    assert(sample >= 0 && sample < 1);
+    // infinite lights and the tree as a whole are equally likely candidates
+    const uint32_t n_candidates = infinite.size() + (nodes.empty() ? 0 : 1);
+    if (n_candidates == 0) return { nullptr, 0.f };
+    const float p_infinite = infinite.size() / float(n_candidates);
+    if (sample < p_infinite) {
+        const uint32_t index = std::min(uint32_t(sample * n_candidates), uint32_t(infinite.size() - 1));
+        return { infinite[index], 1.f / n_candidates };
+    }
+    float u = fminf((sample - p_infinite) / (1.f - p_infinite), ONE_MINUS_EPS);
+    float pmf = 1.f - p_infinite;
+    // stochastic traversal
+    uint32_t node = 0;
+    while (!nodes[node].leaf) {
+        const uint32_t left = node + 1, right = nodes[node].index;
+        const float imp_l = nodes[left].bounds.importance(P, N);
+        const float imp_r = nodes[right].bounds.importance(P, N);
+        if (imp_l <= 0.f && imp_r <= 0.f) return { nullptr, 0.f };
+        const float p_left = imp_l / (imp_l + imp_r);
+        if (u < p_left) {
+            node = left;
+            u = fminf(u / p_left, ONE_MINUS_EPS);
+            pmf *= p_left;
+        } else {
+            node = right;
+            u = fminf((u - p_left) / (1.f - p_left), ONE_MINUS_EPS);
+            pmf *= 1.f - p_left;
+        }
+    }
+    // single light: traversal did not check its importance yet
+    if (node == 0 && nodes[0].bounds.importance(P, N) <= 0.f) return { nullptr, 0.f };
+    return { finite[nodes[node].index], pmf };
+}
+
+float LightTree::pdf(const glm::vec3& P, const glm::vec3& N, const Light* light) const {
+    const uint32_t n_candidates = infinite.size() + (nodes.empty() ? 0 : 1);
+    if (!light || n_candidates == 0) return 0.f;
+    if (light->is_infinite())
+        return std::find(infinite.begin(), infinite.end(), light) != infinite.end() ? 1.f / n_candidates : 0.f;
+    const auto it = trails.find(light);
+    if (it == trails.end()) return 0.f;
+    // follow the path to the light's leaf
+    uint64_t trail = it->second;
+    float pmf = 1.f - infinite.size() / float(n_candidates);
+    uint32_t node = 0;
+    while (!nodes[node].leaf) {
+        const uint32_t left = node + 1, right = nodes[node].index;
+        const float imp_l = nodes[left].bounds.importance(P, N);
+        const float imp_r = nodes[right].bounds.importance(P, N);
+        if (imp_l <= 0.f && imp_r <= 0.f) return 0.f;
+        const float p_left = imp_l / (imp_l + imp_r);
+        pmf *= trail & 1 ? 1.f - p_left : p_left;
+        node = trail & 1 ? right : left;
+        trail >>= 1;
+    }
+    if (node == 0 && nodes[0].bounds.importance(P, N) <= 0.f) return 0.f;
+    return pmf;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <tuple>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <glm/glm.hpp>
+
+#include "light.h"
+
+/**
+ * @brief Bounding volume hierarchy over light sources for importance sampling per shading point
+ * @note Finite light sources are organized in a binary tree whose nodes store the merged LightBounds of their subtree.
+ * Traversal picks a child proportional to its estimated importance for the shading point, thus distant or back-facing
+ * lights are rarely selected. Infinite light sources are selected uniformly, with the tree counting as one candidate.
+ */
+class LightTree {
+public:
+    /**
+     * @brief Build the tree
+     *
+     * @param lights Light sources to organize
+     */
+    LightTree(const std::vector<Light*>& lights);
+
+    /**
+     * @brief Stochastically select a light source for the given shading point
+     *
+     * @param P Shading point
+     * @param N Shading normal (or zero to ignore the cosine at the shading point)
+     * @param sample Random sample in [0, 1)
+     *
+     * @return Tuple consisting of:
+     *      - Pointer to selected light source, nullptr if no light source can contribute (const Light*)
+     *      - Probability of selecting this light source (float)
+     */
+    std::tuple<const Light*, float> sample(const glm::vec3& P, const glm::vec3& N, float sample) const;
+
+    /**
+     * @brief Query the probability of selecting a light source for the given shading point
+     *
+     * @param P Shading point
+     * @param N Shading normal (or zero to ignore the cosine at the shading point)
+     * @param light Light source to query the probability for
+     *
+     * @return Probability of selecting this light source
+     */
+    float pdf(const glm::vec3& P, const glm::vec3& N, const Light* light) const;
+
+    inline size_t num_nodes() const { return nodes.size(); }
+    inline size_t nbytes() const { return nodes.size() * sizeof(Node) + (finite.size() + infinite.size()) * sizeof(Light*); }
+
+private:
+    struct Node {
+        LightBounds bounds; ///< Merged bounds of the subtree
+        uint32_t index;     ///< Light index (leaf) or index of the right child (interior, left child is next to its parent)
+        bool leaf;          ///< Leaf or interior node
+    };
+
+    uint32_t build(std::vector<std::tuple<const Light*, LightBounds>>& items, uint32_t begin, uint32_t end, uint64_t trail, uint32_t depth);
+
+    // data
+    std::vector<Node> nodes;                                ///< Nodes in depth-first order, root at index 0
+    std::vector<const Light*> finite;                       ///< Finite light sources referenced by the leaves
+    std::vector<const Light*> infinite;                     ///< Infinite light sources, selected uniformly
+    std::unordered_map<const Light*, uint64_t> trails;      ///< Path from the root to each leaf (bit i set: right child at depth i)
+};
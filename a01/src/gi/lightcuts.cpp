@@ -0,0 +1,169 @@
+#include "lightcuts.h"
+#include "scene.h"
+#include "surface.h"
+#include "sampling.h"
+#include "color.h"
+#include "rng.h"
+#include "ray.h"
+#include <array>
+#include <queue>
+#include <cfloat>
+#include <algorithm>
+
+VPLTree::VPLTree(const std::vector<PathVertex>& vertices, float min_dist) : min_dist2(min_dist * min_dist) {
+    vpls.reserve(vertices.size());
+    for (const PathVertex& v : vertices) {
+        if (v.infinite || v.escaped || !v.hit.valid) continue;
+        // light vertices emit their throughput, surface vertices reflect it diffusely
+        const glm::vec3 I = v.on_light ? v.throughput : v.throughput * v.hit.albedo() * INVPI;
+        if (luma(I) > 0.f)
+            vpls.push_back(VPL{ v.hit.P, v.hit.N, I });
+    }
+    if (vpls.empty()) return;
+    std::vector<uint32_t> indices(vpls.size());
+    for (uint32_t i = 0; i < indices.size(); ++i)
+        indices[i] = i;
+    nodes.reserve(2 * vpls.size() - 1);
+    build(indices, 0, indices.size());
+}
+
+uint32_t VPLTree::build(std::vector<uint32_t>& indices, uint32_t begin, uint32_t end) {
+    const uint32_t node = nodes.size();
+    nodes.emplace_back();
+    if (end - begin == 1) {
+        const VPL& vpl = vpls[indices[begin]];
+        Node& leaf = nodes[node];
+        leaf.bounds.bb_min = leaf.bounds.bb_max = vpl.P;
+        leaf.bounds.axis = vpl.N;
+        leaf.bounds.power = luma(vpl.I);
+        leaf.I = vpl.I;
+        leaf.rep = indices[begin];
+        leaf.right = 0;
+        return node;
+    }
+    // split at the median along the largest extent of the positions
+    glm::vec3 bb_min(FLT_MAX), bb_max(-FLT_MAX);
+    for (uint32_t i = begin; i < end; ++i) {
+        bb_min = glm::min(bb_min, vpls[indices[i]].P);
+        bb_max = glm::max(bb_max, vpls[indices[i]].P);
+    }
+    const glm::vec3 extent = bb_max - bb_min;
+    const int axis = extent.x > extent.y && extent.x > extent.z ? 0 : extent.y > extent.z ? 1 : 2;
+    const uint32_t mid = (begin + end) / 2;
+    std::nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end, [&](uint32_t a, uint32_t b) {
+        return vpls[a].P[axis] < vpls[b].P[axis];
+    });
+    const uint32_t left = build(indices, begin, mid);
+    const uint32_t right = build(indices, mid, end);
+    // merge children, pick the representative proportional to intensity
+    const Node& l = nodes[left];
+    const Node& r = nodes[right];
+    Node merged;
+    merged.bounds = LightBounds::merge(l.bounds, r.bounds);
+    merged.I = l.I + r.I;
+    merged.rep = RNG::uniform<float>() * (l.bounds.power + r.bounds.power) < l.bounds.power ? l.rep : r.rep;
+    merged.right = right;
+    nodes[node] = merged;
+    return node;
+}
+
+glm::vec3 VPLTree::eval(const Scene& scene, const SurfaceInteraction& hit, const glm::vec3& w_o, const VPL& vpl) const {
+    auto [f, shadow_ray] = unshadowed(hit, vpl);
+    if (luma(f) <= 0.f) return glm::vec3(0);
+    return scene.occluded(shadow_ray) ? glm::vec3(0) : f;
+}
+
+std::tuple<glm::vec3, Ray> VPLTree::unshadowed(const SurfaceInteraction& hit, const VPL& vpl) const {
+    const glm::vec3 to_vpl = vpl.P - hit.P;
+    const float dist2 = glm::dot(to_vpl, to_vpl);
+    if (dist2 <= 0.f) return { glm::vec3(0), Ray() };
+    const float dist = sqrtf(dist2);
+    const glm::vec3 w_i = to_vpl / dist;
+    const float cos_vpl = glm::dot(vpl.N, -w_i);
+    const float cos_hit = glm::dot(hit.N, w_i);
+    if (cos_vpl <= 0.f || cos_hit <= 0.f) return { glm::vec3(0), Ray() };
+    // diffuse receiver, matching the material bound (and independent of the BRDF implementations)
+    const glm::vec3 f = hit.albedo() * INVPI * cos_hit * cos_vpl / fmaxf(dist2, min_dist2);
+    return { f, hit.spawn_ray(w_i, dist * (1.f - 1e-3f)) };
+}
+
+float VPLTree::error_bound(const Node& node, const SurfaceInteraction& hit) const {
+    const LightBounds& b = node.bounds;
+    // minimal squared distance to the cluster's box
+    const glm::vec3 closest = glm::clamp(hit.P, b.bb_min, b.bb_max);
+    const float dist2 = fmaxf(glm::dot(hit.P - closest, hit.P - closest), min_dist2);
+    // bounding sphere of the box as seen from the shading point
+    const glm::vec3 pc = b.centroid();
+    const float r2 = glm::dot(b.bb_max - b.bb_min, b.bb_max - b.bb_min) * .25f;
+    const float dist2_c = glm::dot(hit.P - pc, hit.P - pc);
+    const glm::vec3 w = dist2_c > 0.f ? (hit.P - pc) / sqrtf(dist2_c) : glm::vec3(0, 0, 1);
+    const float cos_b = dist2_c <= r2 ? -1.f : sqrtf(fmaxf(0.f, 1.f - r2 / dist2_c));
+    const float sin_b = sin_theta(cos_b);
+    // upper bound of the VPL cosines
+    const float cos_w = glm::dot(b.axis, w);
+    const float cos_x = cos_sub_clamped(sin_theta(cos_w), cos_w, sin_theta(b.cos_theta_o), b.cos_theta_o);
+    const float cos_vpl = cos_sub_clamped(sin_theta(cos_x), cos_x, sin_b, cos_b);
+    if (cos_vpl <= 0.f) return 0.f;
+    // upper bound of the receiver cosine
+    const float cos_i = glm::dot(hit.N, -w);
+    const float cos_hit = cos_sub_clamped(sin_theta(cos_i), cos_i, sin_b, cos_b);
+    if (cos_hit <= 0.f) return 0.f;
+    // diffuse material bound
+    return luma(node.I) * luma(hit.albedo()) * INVPI * cos_vpl * cos_hit / dist2;
+}
+
+std::tuple<glm::vec3, uint32_t> VPLTree::shade(const Scene& scene, const SurfaceInteraction& hit, const glm::vec3& w_o, float max_error, uint32_t max_cut) const {
+    if (nodes.empty()) return { glm::vec3(0), 0 };
+    struct Cluster {
+        float bound;        ///< Upper error bound
+        uint32_t node;      ///< Tree node
+        glm::vec3 unit;     ///< Visible contribution of the representative per unit intensity
+        inline bool operator<(const Cluster& c) const { return bound < c.bound; }
+    };
+    const auto make_cluster = [&](uint32_t node, const glm::vec3& unit) {
+        return Cluster{ nodes[node].right ? error_bound(nodes[node], hit) : 0.f, node, unit };
+    };
+    std::priority_queue<Cluster> cut;
+    cut.push(make_cluster(0, eval(scene, hit, w_o, vpls[nodes[0].rep])));
+    glm::vec3 L = nodes[0].I * cut.top().unit;
+    // refine the cluster with the largest error bound until all bounds are within the relative error
+    while (cut.size() < max_cut) {
+        const Cluster c = cut.top();
+        if (!nodes[c.node].right || c.bound <= max_error * luma(L)) break;
+        cut.pop();
+        L -= nodes[c.node].I * c.unit;
+        for (const uint32_t child : { c.node + 1, nodes[c.node].right }) {
+            // one child shares the parent's representative, thus reuse its shadow ray
+            const glm::vec3 unit = nodes[child].rep == nodes[c.node].rep ? c.unit : eval(scene, hit, w_o, vpls[nodes[child].rep]);
+            cut.push(make_cluster(child, unit));
+            L += nodes[child].I * unit;
+        }
+    }
+    return { glm::max(L, glm::vec3(0)), cut.size() };
+}
+
+glm::vec3 VPLTree::shade_brute_force(const Scene& scene, const SurfaceInteraction& hit, const glm::vec3& w_o) const {
+    // gather unshadowed contributions and trace their shadow rays in batches, as ShadowQueue does
+    static constexpr uint32_t BATCH = 256;
+    std::array<Ray, BATCH> rays;
+    std::array<glm::vec3, BATCH> contributions;
+    std::array<uint64_t, BATCH / 64> occluded;
+    uint32_t count = 0;
+    glm::vec3 L(0);
+    const auto flush = [&]() {
+        scene.occluded(rays.data(), count, occluded.data());
+        for (uint32_t i = 0; i < count; ++i)
+            if (!((occluded[i / 64] >> (i % 64)) & 1))
+                L += contributions[i];
+        count = 0;
+    };
+    for (const VPL& vpl : vpls) {
+        const auto [f, shadow_ray] = unshadowed(hit, vpl);
+        if (luma(f) <= 0.f) continue;
+        rays[count] = shadow_ray;
+        contributions[count] = vpl.I * f;
+        if (++count == BATCH) flush();
+    }
+    if (count > 0) flush();
+    return L;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <tuple>
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "light.h"
+#include "bdpt.h"
+
+class Scene;
+class SurfaceInteraction;
+
+/**
+ * @brief Virtual point light, i.e. a point on a surface emitting with a cosine falloff around its normal
+ */
+struct VPL {
+    glm::vec3 P;    ///< Position
+    glm::vec3 N;    ///< Emission normal
+    glm::vec3 I;    ///< Intensity along the normal
+};
+
+/**
+ * @brief Light tree over VPLs, evaluated per shading point via a cut with bounded relative error (Lightcuts, Walter et al. 2005)
+ * @note Each cluster stores its summed intensity, bounding box, normal cone and a representative VPL. Refinement of
+ * the cut stops once the upper error bound of every cluster falls below a fraction of the current estimate.
+ * Surface vertices are converted to diffuse VPLs, receivers are shaded (and bounded) as diffuse via their albedo.
+ * The cut traces one shadow ray per refinement, since the visible estimate decides when to stop refining, whereas
+ * gathering all VPLs traces its shadow rays in batches.
+ */
+class VPLTree {
+public:
+    /**
+     * @brief Convert light path vertices to VPLs and build the tree
+     *
+     * @param vertices Light path vertices (vertices on infinite light sources are skipped)
+     * @param min_dist Minimum distance for evaluating the geometry term, avoids VPL singularities
+     */
+    VPLTree(const std::vector<PathVertex>& vertices, float min_dist);
+
+    /**
+     * @brief Shade a surface point with a lightcut
+     *
+     * @param scene Scene for shadow rays
+     * @param hit Shading point
+     * @param w_o Direction to the viewer
+     * @param max_error Maximum relative error per cluster (e.g. 0.02)
+     * @param max_cut Maximum number of clusters in the cut
+     *
+     * @return Tuple consisting of:
+     *      - Reflected radiance (vec3)
+     *      - Size of the cut (uint)
+     */
+    std::tuple<glm::vec3, uint32_t> shade(const Scene& scene, const SurfaceInteraction& hit, const glm::vec3& w_o, float max_error, uint32_t max_cut) const;
+
+    /**
+     * @brief Shade a surface point by gathering all VPLs (reference), shadow rays are traced in batches
+     *
+     * @param scene Scene for shadow rays
+     * @param hit Shading point
+     * @param w_o Direction to the viewer
+     *
+     * @return Reflected radiance
+     */
+    glm::vec3 shade_brute_force(const Scene& scene, const SurfaceInteraction& hit, const glm::vec3& w_o) const;
+
+    inline size_t size() const { return vpls.size(); }
+    inline size_t num_nodes() const { return nodes.size(); }
+
+private:
+    struct Node {
+        LightBounds bounds; ///< Bounding box and normal cone of the cluster
+        glm::vec3 I;        ///< Summed intensity
+        uint32_t rep;       ///< Representative VPL
+        uint32_t right;     ///< Index of the right child, 0 for leaves (left child is next to its parent)
+    };
+
+    uint32_t build(std::vector<uint32_t>& indices, uint32_t begin, uint32_t end);
+    glm::vec3 eval(const Scene& scene, const SurfaceInteraction& hit, const glm::vec3& w_o, const VPL& vpl) const;
+    // contribution per unit intensity ignoring visibility, and the shadow ray deciding it
+    std::tuple<glm::vec3, Ray> unshadowed(const SurfaceInteraction& hit, const VPL& vpl) const;
+    float error_bound(const Node& node, const SurfaceInteraction& hit) const;
+
+    // data
+    std::vector<VPL> vpls;      ///< All VPLs
+    std::vector<Node> nodes;    ///< Nodes in depth-first order, root at index 0
+    float min_dist2;            ///< Squared minimum distance for the geometry term
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+/**
+ * @brief Read-only memory mapping of a file on disk
+ */
+class MappedFile {
+public:
+    /**
+     * @brief Map the given file into memory
+     * @note Check operator bool() for success, e.g. the file may not exist.
+     *
+     * @param path Path to the file
+     * @param random Advise the kernel of random instead of sequential access (e.g. texture lookups)
+     */
+    MappedFile(const std::filesystem::path& path, bool random = false);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    inline explicit operator bool() const { return ptr != nullptr; }
+    inline const uint8_t* data() const { return (const uint8_t*)ptr; }
+    inline size_t size() const { return len; }
+
+private:
+    // data
+    void* ptr;      ///< Start of the mapping, nullptr if mapping failed
+    size_t len;     ///< Size of the mapping in bytes
+};
@@ -2,6 +2,7 @@
 #include "sampling.h"
 #include "light.h"
 #include "color.h"
+#include "asset_cache.h"
 
 #include <mutex>
 
@@ -43,32 +44,34 @@ Material::Material(const aiMaterial *material_ai, const std::filesystem::path& b
     if (material_ai->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
         aiString path_ai;
         material_ai->GetTexture(aiTextureType_DIFFUSE, 0, &path_ai);
-        albedo_tex.load(base_path / path_ai.C_Str());
+        albedo_tex = load_texture_cached(base_path / path_ai.C_Str());
     }
     // fetch normal tex
     if (material_ai->GetTextureCount(aiTextureType_HEIGHT) > 0) {
         aiString path_ai;
         material_ai->GetTexture(aiTextureType_HEIGHT, 0, &path_ai);
-        normal_tex.load(base_path / path_ai.C_Str(), false);
+        normal_tex = load_texture_cached(base_path / path_ai.C_Str(), false);
     }
     // fetch alpha tex (or alpha channel from diffuse tex)
     if (material_ai->GetTextureCount(aiTextureType_OPACITY) > 0) {
         aiString path_ai;
         material_ai->GetTexture(aiTextureType_OPACITY, 0, &path_ai);
-        alpha_tex.load(base_path / path_ai.C_Str());
-    } else if (albedo_tex.has_alpha)
-        alpha_tex.load_alpha(albedo_tex.path());
+        alpha_tex = load_texture_cached(base_path / path_ai.C_Str());
+    } else if (albedo_tex && albedo_tex->has_alpha)
+        alpha_tex = load_alpha_cached(albedo_tex->path(), albedo_tex); // reuses the decoded albedo if possible
+    if (alpha_tex)
+        alpha_mask.build(*alpha_tex);
     // fetch roughness tex
     if (material_ai->GetTextureCount(aiTextureType_SHININESS) > 0) {
         aiString path_ai;
         material_ai->GetTexture(aiTextureType_OPACITY, 0, &path_ai);
-        roughness_tex.load(base_path / path_ai.C_Str());
+        roughness_tex = load_texture_cached(base_path / path_ai.C_Str());
     }
     // fetch emissive tex
     if (material_ai->GetTextureCount(aiTextureType_EMISSIVE) > 0) {
         aiString path_ai;
         material_ai->GetTexture(aiTextureType_EMISSIVE, 0, &path_ai);
-        emissive_tex.load(base_path / path_ai.C_Str());
+        emissive_tex = load_texture_cached(base_path / path_ai.C_Str());
     }
 
     // material preset selection hack
@@ -87,25 +90,25 @@ Material::~Material() {
     }
 }
 
-glm::vec3 Material::albedo(const glm::vec2& TC) const {
-    return albedo_tex ? albedo_tex(TC) : albedo_col;
+glm::vec3 Material::albedo(const glm::vec2& TC, const glm::vec2& dTCdx, const glm::vec2& dTCdy) const {
+    return albedo_tex ? albedo_tex->filtered(TC, dTCdx, dTCdy) : albedo_col;
 }
 
-glm::vec3 Material::emissive(const glm::vec2& TC) const {
+glm::vec3 Material::emissive(const glm::vec2& TC, const glm::vec2& dTCdx, const glm::vec2& dTCdy) const {
     if (emissive_strength <= 0) return glm::vec3(0);
-    return emissive_tex ? emissive_tex(TC) * emissive_strength : albedo(TC) * emissive_strength;
+    return emissive_tex ? emissive_tex->filtered(TC, dTCdx, dTCdy) * emissive_strength : albedo(TC, dTCdx, dTCdy) * emissive_strength;
 }
 
-float Material::roughness(const glm::vec2& TC) const {
-    return roughness_tex ? luma(roughness_tex(TC)) : roughness_val;
+float Material::roughness(const glm::vec2& TC, const glm::vec2& dTCdx, const glm::vec2& dTCdy) const {
+    return roughness_tex ? luma(roughness_tex->filtered(TC, dTCdx, dTCdy)) : roughness_val;
 }
 
-glm::vec3 Material::normalmap(const glm::vec3 &N, const glm::vec2 &TC) const {
-    return normal_tex ? align(N, normalize(normal_tex(TC) * 2.f - 1.f)) : N;
+glm::vec3 Material::normalmap(const glm::vec3 &N, const glm::vec2 &TC, const glm::vec2& dTCdx, const glm::vec2& dTCdy) const {
+    return normal_tex ? align(N, normalize(normal_tex->filtered(TC, dTCdx, dTCdy) * 2.f - 1.f)) : N;
 }
 
 float Material::alphamap(const glm::vec2& TC) const {
-    return alpha_tex ? luma(alpha_tex(TC)) : 1.f;
+    return alpha_tex ? luma(alpha_tex->bilin(TC)) : 1.f;
 }
 
 void Material::set_to(const std::string& type) {
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <filesystem>
 
 #include "brdf.h"
@@ -19,11 +20,11 @@ public:
     Material(const aiMaterial *material_ai, const std::filesystem::path& base_path);
     virtual ~Material();
 
-    // material lookups (texture or static)
-    glm::vec3 albedo(const glm::vec2& TC) const;
-    float roughness(const glm::vec2& TC) const;
-    glm::vec3 emissive(const glm::vec2& TC) const;
-    glm::vec3 normalmap(const glm::vec3& N, const glm::vec2& TC) const;
+    // material lookups (texture or static), filtered over the footprint given via texture coordinate derivatives
+    glm::vec3 albedo(const glm::vec2& TC, const glm::vec2& dTCdx = glm::vec2(0), const glm::vec2& dTCdy = glm::vec2(0)) const;
+    float roughness(const glm::vec2& TC, const glm::vec2& dTCdx = glm::vec2(0), const glm::vec2& dTCdy = glm::vec2(0)) const;
+    glm::vec3 emissive(const glm::vec2& TC, const glm::vec2& dTCdx = glm::vec2(0), const glm::vec2& dTCdy = glm::vec2(0)) const;
+    glm::vec3 normalmap(const glm::vec3& N, const glm::vec2& TC, const glm::vec2& dTCdx = glm::vec2(0), const glm::vec2& dTCdy = glm::vec2(0)) const;
     float alphamap(const glm::vec2& TC) const;
 
     // (lossy) translatation between phong exponent and roughness
@@ -66,12 +67,13 @@ public:
     float absorb = 0;                       ///< [0, 3] absorbtion rate of conductor materials
     glm::vec3 albedo_col  = glm::vec3(1);   ///< Base albedo (if no texture present)
     float emissive_strength = 0;            ///< Strength of light emission, is light source if > 0
-    // textures
-    Texture albedo_tex;                     ///< Albedo texture
-    Texture normal_tex;                     ///< Normal map texture
-    Texture alpha_tex;                      ///< Alpha map texture
-    Texture roughness_tex;                  ///< Roughness map texture
-    Texture emissive_tex;                   ///< Emissive texture
+    // textures (shared via the texture cache, nullptr if not present)
+    std::shared_ptr<Texture> albedo_tex;    ///< Albedo texture
+    std::shared_ptr<Texture> normal_tex;    ///< Normal map texture
+    std::shared_ptr<Texture> alpha_tex;     ///< Alpha map texture
+    std::shared_ptr<Texture> roughness_tex; ///< Roughness map texture
+    std::shared_ptr<Texture> emissive_tex;  ///< Emissive texture
+    AlphaMask alpha_mask;                   ///< One bit per texel version of alpha_tex for fast alpha tests
 
 public:
     static std::vector<Material*> instances; ///< global vector of all materials (for UI)
@@ -3,10 +3,12 @@
 #include "surface.h"
 #include "random.h"
 #include "timer.h"
+#include "color.h"
 #include "par_shapes.h"
 #include <assimp/scene.h>
 #include <assimp/mesh.h>
 #include <cfloat>
+#include <algorithm>
 #include <embree3/rtcore_ray.h>
 
 // intersection filter function querying the materials alpha map
@@ -14,16 +16,20 @@ void alphamapFilter(const RTCFilterFunctionNArguments* args) {
     STAT("alpha filter");
     if (!args->context || !args->geometryUserPtr) return;
     Mesh* mesh = (Mesh*)args->geometryUserPtr;
-    if (!mesh->mat->alpha_tex || mesh->tcs.empty()) return;
+    if (!mesh->mat->alpha_tex || !mesh->has_tcs()) return;
+    const bool masked = !mesh->alpha_mixed.empty() && mesh->mat->alpha_mask;
 
     for (uint32_t i = 0; i < args->N; ++i) {
         if (args->valid[i] != -1) continue;
-        const glm::uvec3& tri = mesh->ibo[RTCHitN_primID(args->hit, args->N, i)];
+        const uint32_t primID = RTCHitN_primID(args->hit, args->N, i);
+        if (masked && !((mesh->alpha_mixed[primID >> 5] >> (primID & 31)) & 1))
+            continue; // fully opaque triangle
+        const glm::uvec3& tri = mesh->ibo[primID];
         const float u = RTCHitN_u(args->hit, args->N, i);
         const float v = RTCHitN_v(args->hit, args->N, i);
-        const glm::vec2& TC = (1 - u - v) * mesh->tcs[tri[0]] + u * mesh->tcs[tri[1]] + v * mesh->tcs[tri[2]];
+        const glm::vec2 TC = (1 - u - v) * mesh->tc(tri[0]) + u * mesh->tc(tri[1]) + v * mesh->tc(tri[2]);
         // perform alpha test
-        if (mesh->mat->alphamap(TC) < .1f)
+        if (masked ? !mesh->mat->alpha_mask.test(TC) : mesh->mat->alphamap(TC) < AlphaMask::THRESHOLD)
             args->valid[i] = 0; // reject hit
     }
 }
@@ -72,37 +78,37 @@ Mesh::Mesh(RTCDevice& device, RTCScene& scene, const std::shared_ptr<Material>&
         ibo.emplace_back(f.mIndices[0], f.mIndices[1], f.mIndices[2]);
     }
 
+    // drop fully transparent triangles and flag the ones needing alpha tests
+    classify_alpha();
+
+    // optionally replace normals and tex coords with compact encodings
+    if (COMPRESS_ATTRIBUTES)
+        compress_attributes();
+    if (PRECOMPUTE_TRIANGLES)
+        build_triangle_data();
+
     // tell embree about the mesh
     rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, vbo.data(), 0, sizeof(glm::vec3), vbo.size());
     rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, ibo.data(), 0, sizeof(glm::uvec3), ibo.size());
-    rtcSetGeometryVertexAttributeCount(geom, has_tcs ? 2 : 1);
-    rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3, normals.data(), 0, sizeof(glm::vec3), normals.size());
-    if (has_tcs)
-        rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, RTC_FORMAT_FLOAT2, tcs.data(), 0, sizeof(glm::vec2), tcs.size());
+    if (!is_compressed()) { // compressed attributes are decoded in the hit point interpolation instead
+        rtcSetGeometryVertexAttributeCount(geom, has_tcs ? 2 : 1);
+        rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3, normals.data(), 0, sizeof(glm::vec3), normals.size());
+        if (has_tcs)
+            rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, RTC_FORMAT_FLOAT2, tcs.data(), 0, sizeof(glm::vec2), tcs.size());
+    }
 
     // set user data pointer
     rtcSetGeometryUserData(geom, this);
 
-    // set intersection filter function if material has alphamap
-    if (mat->alpha_tex) {
-        rtcSetGeometryIntersectFilterFunction(geom, alphamapFilter);
-        rtcSetGeometryOccludedFilterFunction(geom, alphamapFilter);
-    }
+    // set intersection filter function if material has alphamap (and triangles need alpha tests)
+    set_alpha_filter();
 
     // commit and attach geometry
     rtcCommitGeometry(geom);
     geomID = rtcAttachGeometry(scene, geom);
 
     // build distribution over triangle area for importance sampling
-    std::vector<float> f(ibo.size());
-    for (uint32_t i = 0; i < ibo.size(); ++i) {
-        const glm::uvec3& tri = ibo[i];
-        const glm::vec3 AB = vbo[tri[1]] - vbo[tri[0]];
-        const glm::vec3 AC = vbo[tri[2]] - vbo[tri[0]];
-        f[i] = 0.5f * length(cross(AB, AC));
-
-    }
-    area_distribution.reset(new Distribution1D(f.data(), f.size()));
+    build_area_distribution();
 
     // build area light
     area_light.reset(new AreaLight(*this));
@@ -146,48 +152,251 @@ Mesh::Mesh(RTCDevice& device, RTCScene& scene, const std::shared_ptr<Material>&
     for (uint32_t i = 0; i < numTriangles; ++i)
         ibo.emplace_back(par_mesh->triangles[3*i+0], par_mesh->triangles[3*i+1], par_mesh->triangles[3*i+2]);
 
+    // drop fully transparent triangles and flag the ones needing alpha tests
+    classify_alpha();
+
+    // optionally replace normals and tex coords with compact encodings
+    if (COMPRESS_ATTRIBUTES)
+        compress_attributes();
+    if (PRECOMPUTE_TRIANGLES)
+        build_triangle_data();
+
     // tell embree about the mesh
     rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, vbo.data(), 0, sizeof(glm::vec3), vbo.size());
     rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, ibo.data(), 0, sizeof(glm::uvec3), ibo.size());
-    rtcSetGeometryVertexAttributeCount(geom, has_tcs ? 2 : 1);
-    rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3, normals.data(), 0, sizeof(glm::vec3), normals.size());
-    if (has_tcs)
-        rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, RTC_FORMAT_FLOAT2, tcs.data(), 0, sizeof(glm::vec2), tcs.size());
+    if (!is_compressed()) { // compressed attributes are decoded in the hit point interpolation instead
+        rtcSetGeometryVertexAttributeCount(geom, has_tcs ? 2 : 1);
+        rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 0, RTC_FORMAT_FLOAT3, normals.data(), 0, sizeof(glm::vec3), normals.size());
+        if (has_tcs)
+            rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX_ATTRIBUTE, 1, RTC_FORMAT_FLOAT2, tcs.data(), 0, sizeof(glm::vec2), tcs.size());
+    }
 
     // set user data pointer
     rtcSetGeometryUserData(geom, this);
 
-    // set intersection filter function if material has alphamap
-    if (mat->alpha_tex) {
-        rtcSetGeometryIntersectFilterFunction(geom, alphamapFilter);
-        rtcSetGeometryOccludedFilterFunction(geom, alphamapFilter);
-    }
+    // set intersection filter function if material has alphamap (and triangles need alpha tests)
+    set_alpha_filter();
 
     // commit and attach geometry
     rtcCommitGeometry(geom);
     geomID = rtcAttachGeometry(scene, geom);
 
     // build distribution over triangle area for importance sampling
+    build_area_distribution();
+
+    // build area light
+    area_light.reset(new AreaLight(*this));
+}
+
+Mesh::~Mesh() {
+    detach();
+    rtcReleaseGeometry(geom);
+}
+
+void Mesh::attach() {
+    if (geomID == RTC_INVALID_GEOMETRY_ID)
+        geomID = rtcAttachGeometry(scene, geom);
+}
+
+void Mesh::detach() {
+    if (geomID != RTC_INVALID_GEOMETRY_ID) {
+        rtcDetachGeometry(scene, geomID);
+        geomID = RTC_INVALID_GEOMETRY_ID;
+    }
+}
+
+size_t Mesh::nbytes() const {
+    return vbo.capacity() * sizeof(glm::vec3) + ibo.capacity() * sizeof(glm::uvec3) +
+        normals.capacity() * sizeof(glm::vec3) + tcs.capacity() * sizeof(glm::vec2) +
+        normals_oct.capacity() * sizeof(uint32_t) + tcs_half.capacity() * sizeof(uint32_t) +
+        tri_data.capacity() * sizeof(TriangleData) + tri_data_compact.capacity() * sizeof(CompactTriangleData) +
+        ibo_unclassified.capacity() * sizeof(glm::uvec3) + alpha_mixed.capacity() * sizeof(uint32_t) +
+        (area_sampler ? area_sampler->nbytes() : 0) +
+        (emission_sampler ? emission_sampler->nbytes() : 0);
+}
+
+void Mesh::build_area_distribution() {
     std::vector<float> f(ibo.size());
-    for (uint32_t i = 0; i < ibo.size(); ++i) {
+    #pragma omp parallel for
+    for (int i = 0; i < int(ibo.size()); ++i) {
         const glm::uvec3& tri = ibo[i];
         const glm::vec3 AB = vbo[tri[1]] - vbo[tri[0]];
         const glm::vec3 AC = vbo[tri[2]] - vbo[tri[0]];
         f[i] = 0.5f * length(cross(AB, AC));
+    }
+    area_sampler.reset(new AliasTable(f.data(), f.size()));
+}
 
+void Mesh::set_alpha_filter() {
+    const bool filter = mat->alpha_tex && (!ALPHA_MASK || !mat->alpha_mask || !alpha_mixed.empty());
+    rtcSetGeometryIntersectFilterFunction(geom, filter ? alphamapFilter : nullptr);
+    rtcSetGeometryOccludedFilterFunction(geom, filter ? alphamapFilter : nullptr);
+}
+
+void Mesh::update_material() {
+    if (derived.alpha_tex != mat->alpha_tex.get() || derived.alpha_mask != ALPHA_MASK) {
+        // re-classify all imported triangles and rebuild everything indexed by primID
+        const bool dropped = !ibo_unclassified.empty();
+        classify_alpha();
+        if (dropped || !ibo_unclassified.empty()) {
+            if (!tri_data.empty() || !tri_data_compact.empty())
+                build_triangle_data();
+            rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, ibo.data(), 0, sizeof(glm::uvec3), ibo.size());
+            build_area_distribution();
+            // rebuilt on the next Scene::commit
+            emission_sampler.reset();
+            emission_integral = glm::vec3(0);
+        }
+        set_alpha_filter();
+        rtcCommitGeometry(geom);
+    }
+    const Texture* tex = emission_texture();
+    if (emission_sampler && (derived.emission_tex != tex || (!tex && derived.albedo_col != mat->albedo_col))) {
+        // rebuilt on the next Scene::commit
+        emission_sampler.reset();
+        emission_integral = glm::vec3(0);
     }
-    area_distribution.reset(new Distribution1D(f.data(), f.size()));
+}
 
-    // build area light
-    area_light.reset(new AreaLight(*this));
+void Mesh::classify_alpha() {
+    // start over from all imported triangles
+    if (!ibo_unclassified.empty()) {
+        ibo.swap(ibo_unclassified);
+        std::vector<glm::uvec3>().swap(ibo_unclassified);
+    }
+    derived.alpha_tex = mat->alpha_tex.get();
+    derived.alpha_mask = ALPHA_MASK;
+    alpha_mixed.clear();
+    if (!ALPHA_MASK || !mat->alpha_tex || !mat->alpha_mask || !has_tcs()) return;
+    std::vector<uint8_t> coverage(ibo.size());
+    #pragma omp parallel for
+    for (int i = 0; i < int(ibo.size()); ++i) {
+        const glm::uvec3& tri = ibo[i];
+        coverage[i] = mat->alpha_mask.classify(tc(tri[0]), tc(tri[1]), tc(tri[2]));
+    }
+    // compact the index buffer, keeping all triangles (and testing them) if none would remain
+    const size_t num_transparent = std::count(coverage.begin(), coverage.end(), uint8_t(AlphaMask::TRANSPARENT));
+    if (num_transparent == ibo.size())
+        std::fill(coverage.begin(), coverage.end(), AlphaMask::MIXED);
+    else if (num_transparent > 0) {
+        ibo_unclassified = ibo; // kept for re-classification on material changes
+        size_t n = 0;
+        for (size_t i = 0; i < ibo.size(); ++i) {
+            if (coverage[i] == AlphaMask::TRANSPARENT) continue;
+            ibo[n] = ibo[i];
+            coverage[n++] = coverage[i];
+        }
+        ibo.resize(n);
+        ibo.shrink_to_fit();
+        coverage.resize(n);
+    }
+    if (std::find(coverage.begin(), coverage.end(), AlphaMask::MIXED) == coverage.end()) return;
+    alpha_mixed.assign((ibo.size() + 31) / 32, 0);
+    for (size_t i = 0; i < ibo.size(); ++i)
+        if (coverage[i] == AlphaMask::MIXED)
+            alpha_mixed[i >> 5] |= 1u << (i & 31);
 }
 
-Mesh::~Mesh() {
-    rtcDetachGeometry(scene, geomID);
-    rtcReleaseGeometry(geom);
+void Mesh::compress_attributes() {
+    normals_oct.resize(normals.size());
+    for (size_t i = 0; i < normals.size(); ++i)
+        normals_oct[i] = encode_octahedral(normals[i]);
+    tcs_half.resize(tcs.size());
+    for (size_t i = 0; i < tcs.size(); ++i)
+        tcs_half[i] = encode_half2(tcs[i]);
+    // release full precision buffers
+    std::vector<glm::vec3>().swap(normals);
+    std::vector<glm::vec2>().swap(tcs);
+}
+
+void Mesh::build_triangle_data() {
+    const bool tcs_present = has_tcs();
+    if (is_compressed()) {
+        std::vector<TriangleData>().swap(tri_data);
+        tri_data_compact.resize(ibo.size());
+        #pragma omp parallel for
+        for (int i = 0; i < int(ibo.size()); ++i) {
+            const glm::uvec3& tri = ibo[i];
+            CompactTriangleData& t = tri_data_compact[i];
+            t.area = 0.5f * glm::length(glm::cross(vbo[tri[1]] - vbo[tri[0]], vbo[tri[2]] - vbo[tri[0]]));
+            for (uint32_t j = 0; j < 3; ++j)
+                t.N[j] = normals_oct[tri[j]];
+            t.TC0 = tcs_present ? tc(tri[0]) : glm::vec2(0);
+            t.dTC1 = encode_half2(tcs_present ? tc(tri[1]) - t.TC0 : glm::vec2(0));
+            t.dTC2 = encode_half2(tcs_present ? tc(tri[2]) - t.TC0 : glm::vec2(0));
+        }
+        return;
+    }
+    std::vector<CompactTriangleData>().swap(tri_data_compact);
+    tri_data.resize(ibo.size());
+    #pragma omp parallel for
+    for (int i = 0; i < int(ibo.size()); ++i) {
+        const glm::uvec3& tri = ibo[i];
+        TriangleData& t = tri_data[i];
+        t.area = 0.5f * glm::length(glm::cross(vbo[tri[1]] - vbo[tri[0]], vbo[tri[2]] - vbo[tri[0]]));
+        t.N0 = normal(tri[0]);
+        t.dN1 = normal(tri[1]) - t.N0;
+        t.dN2 = normal(tri[2]) - t.N0;
+        t.TC0 = tcs_present ? tc(tri[0]) : glm::vec2(0);
+        t.dTC1 = encode_half2(tcs_present ? tc(tri[1]) - t.TC0 : glm::vec2(0));
+        t.dTC2 = encode_half2(tcs_present ? tc(tri[2]) - t.TC0 : glm::vec2(0));
+    }
+}
+
+const Texture* Mesh::emission_texture() const {
+    return mat->emissive_tex ? mat->emissive_tex.get() : mat->albedo_tex ? mat->albedo_tex.get() : nullptr;
+}
+
+void Mesh::build_emission_distribution() {
+    static constexpr uint32_t MAX_SUBDIV = 16; // at most 256 lookups per triangle
+    const Texture* tex = emission_texture();
+    derived.emission_tex = tex;
+    derived.albedo_col = mat->albedo_col;
+    // sub-triangles covering many texels read prefiltered levels, the texture is shared through the cache,
+    // thus use its existing levels and only prefilter a local copy if it has none
+    std::unique_ptr<Texture> prefiltered;
+    if (tex && tex->levels() == 1 && !tex->is_paged()) {
+        prefiltered = std::make_unique<Texture>(*tex);
+        prefiltered->build_mipmaps();
+        tex = prefiltered.get();
+    }
+    const bool tcs_present = has_tcs();
+    std::vector<float> f(ibo.size());
+    float sum_r = 0, sum_g = 0, sum_b = 0;
+    #pragma omp parallel for reduction(+ : sum_r, sum_g, sum_b)
+    for (int i = 0; i < int(ibo.size()); ++i) {
+        const glm::uvec3& tri = ibo[i];
+        const float area = 0.5f * glm::length(glm::cross(vbo[tri[1]] - vbo[tri[0]], vbo[tri[2]] - vbo[tri[0]]));
+        glm::vec3 E = mat->albedo_col;
+        if (tex && tcs_present) {
+            const glm::vec2 t0 = tc(tri[0]), d1 = tc(tri[1]) - t0, d2 = tc(tri[2]) - t0;
+            // subdivide into k^2 sub-triangles covering about one texel each, evaluated at their centroids
+            const float texels = 0.5f * fabsf(d1.x * d2.y - d1.y * d2.x) * tex->width() * tex->height();
+            const uint32_t k = glm::clamp(uint32_t(ceilf(sqrtf(texels))), 1u, MAX_SUBDIV);
+            const float lod = 0.5f * log2f(fmaxf(texels / (k * k), 1.f));
+            E = glm::vec3(0);
+            for (uint32_t a = 0; a < k; ++a) {
+                for (uint32_t b = 0; a + b < k; ++b) {
+                    E += tex->trilin(t0 + (a + 1.f / 3.f) / k * d1 + (b + 1.f / 3.f) / k * d2, lod);
+                    if (a + b + 1 < k)
+                        E += tex->trilin(t0 + (a + 2.f / 3.f) / k * d1 + (b + 2.f / 3.f) / k * d2, lod);
+                }
+            }
+            E /= float(k * k);
+        } else if (tex)
+            E = (*tex)(glm::vec2(0));
+        f[i] = area * luma(E);
+        sum_r += area * E.r;
+        sum_g += area * E.g;
+        sum_b += area * E.b;
+    }
+    emission_integral = glm::vec3(sum_r, sum_g, sum_b);
+    emission_sampler.reset(new AliasTable(f.data(), f.size()));
 }
 
 std::tuple<SurfaceInteraction, float> Mesh::sample(const glm::vec2& sample) const {
-    auto [primID, pdf] = area_distribution->sample_index(RNG::uniform<float>());
-    return { SurfaceInteraction(sample, primID, this), pdf };
+    // select triangle in O(1) and reuse the remainder of sample.x for the position on it
+    const AliasTable& sampler = emission_sampler ? *emission_sampler : *area_sampler;
+    const auto [primID, pdf, remapped] = sampler.sample_index(sample.x);
+    return { SurfaceInteraction(glm::vec2(remapped, sample.y), primID, this), pdf };
 }
@@ -9,11 +9,40 @@
 #include "material.h"
 #include "distribution.h"
 #include "light.h"
+#include "packing.h"
 
 class aiMesh;
 class AreaLight;
 class SurfaceInteraction;
 
+/**
+ * @brief Precomputed per-triangle shading data, one cache line per triangle
+ * @note Attributes are stored as base value plus edge deltas, s.t. lerp(u, v) = base + u * d1 + v * d2.
+ */
+struct alignas(64) TriangleData {
+    glm::vec3 N0;       ///< Vertex normal of first vertex
+    float area;         ///< Triangle surface area
+    glm::vec3 dN1;      ///< Normal delta to second vertex
+    glm::vec3 dN2;      ///< Normal delta to third vertex
+    glm::vec2 TC0;      ///< Texture coords of first vertex
+    uint32_t dTC1;      ///< Texture coord delta to second vertex (half float encoded)
+    uint32_t dTC2;      ///< Texture coord delta to third vertex (half float encoded)
+};
+static_assert(sizeof(TriangleData) == 64, "TriangleData should fill exactly one cache line");
+
+/**
+ * @brief Precomputed per-triangle shading data for compressed meshes, two triangles per cache line
+ * @note Vertex normals keep the octahedral encoding of the compressed attributes, thus are interpolated after decoding.
+ */
+struct alignas(32) CompactTriangleData {
+    uint32_t N[3];      ///< Vertex normals (octahedral encoded)
+    float area;         ///< Triangle surface area
+    glm::vec2 TC0;      ///< Texture coords of first vertex
+    uint32_t dTC1;      ///< Texture coord delta to second vertex (half float encoded)
+    uint32_t dTC2;      ///< Texture coord delta to third vertex (half float encoded)
+};
+static_assert(sizeof(CompactTriangleData) == 32, "CompactTriangleData should fill half a cache line");
+
 class Mesh {
 public:
     Mesh(RTCDevice& device, RTCScene& scene, const std::shared_ptr<Material>& mat, const aiMesh* ai_mesh);
@@ -27,12 +56,70 @@ public:
 
     inline size_t num_triangles() const { return ibo.size(); }
 
-    inline float surface_area() const { assert(area_distribution); return area_distribution->integral(); }
+    inline float surface_area() const { assert(area_sampler); return area_sampler->integral(); }
 
     inline bool is_light() const { assert(mat); return mat->emissive_strength > 0.f; }
 
+    inline bool has_tcs() const { return !tcs.empty() || !tcs_half.empty(); }
+
+    inline bool is_compressed() const { return !normals_oct.empty(); }
+
+    // vertex attribute lookups (decode compact storage if present)
+    inline glm::vec3 normal(uint32_t i) const { return normals_oct.empty() ? normals[i] : decode_octahedral(normals_oct[i]); }
+    inline glm::vec2 tc(uint32_t i) const { return tcs_half.empty() ? tcs[i] : decode_half2(tcs_half[i]); }
+
+    /**
+     * @brief Replace full precision normals and texture coordinates with their compact encodings
+     * @note Positions stay full precision, Embree only receives the vertex and index buffers afterwards.
+     */
+    void compress_attributes();
+
+    /**
+     * @brief Build contiguous per-triangle shading data (area and attribute deltas) indexed by primID
+     * @note Compressed meshes get CompactTriangleData instead, s.t. no full precision normals are kept.
+     */
+    void build_triangle_data();
+
+    /**
+     * @brief Classify triangles against the material's alpha mask: fully transparent ones are dropped from the
+     * index buffer, mixed ones are flagged in alpha_mixed, all others skip the alpha test
+     */
+    void classify_alpha();
+
+    /**
+     * @brief Rebuild (or invalidate) data derived from the material if it changed, i.e. the alpha classification
+     * with everything indexed by primID and the emitter distribution (rebuilt in Scene::commit)
+     * @note Has to be called before committing the Embree scene.
+     */
+    void update_material();
+
+    /**
+     * @brief Build the emitter distribution from triangle area times emission integrated over the triangle (in parallel)
+     * @note The emissive (or albedo) texture is integrated over k^2 sub-triangles matching the texel footprint,
+     * s.t. dark texels of textured emitters receive few samples. Emission strength is factored out.
+     */
+    void build_emission_distribution();
+
+    /**
+     * @brief Attach the geometry to the Embree scene (no-op if already attached)
+     */
+    void attach();
+
+    /**
+     * @brief Detach the geometry from the Embree scene, e.g. to keep the mesh cached without tracing it
+     */
+    void detach();
+
+    /**
+     * @brief Query memory held by this mesh (geometry, attributes and sampling data)
+     *
+     * @return Size in bytes
+     */
+    size_t nbytes() const;
+
     /**
-     * @brief Importance sample a triangle of the mesh according to the relative area
+     * @brief Importance sample a triangle of the mesh according to its emitted power (light sources) or relative area
+     * @note sample.x selects the triangle via the alias table, its remainder is reused for the position on the triangle.
      *
      * @param sample Random sample in [0, 1)
      * @param pdf PDF of returned sample
@@ -41,6 +128,15 @@ public:
      */
     std::tuple<SurfaceInteraction, float> sample(const glm::vec2& sample) const;
 
+    // build area distribution and alias table over triangles
+    void build_area_distribution();
+
+    // install the alpha filter functions if the material has an alpha map and triangles need alpha tests
+    void set_alpha_filter();
+
+    // texture integrated by the emitter distribution (nullptr: constant albedo)
+    const Texture* emission_texture() const;
+
     // data
     RTCGeometry geom;                                   ///< Embree geometry
     uint32_t geomID;                                    ///< Embree geometry ID
@@ -48,12 +144,31 @@ public:
     std::vector<glm::uvec3> ibo;                        ///< Index buffer
     std::vector<glm::vec3> normals;                     ///< Normals buffer
     std::vector<glm::vec2> tcs;                         ///< Texture coor buffer
+    std::vector<uint32_t> normals_oct;                  ///< Compressed normals buffer (octahedral 2x16 bit snorm)
+    std::vector<uint32_t> tcs_half;                     ///< Compressed texture coord buffer (2x16 bit half float)
+    std::vector<TriangleData> tri_data;                 ///< Precomputed per-triangle shading data (optional)
+    std::vector<CompactTriangleData> tri_data_compact;  ///< Precomputed per-triangle shading data of compressed meshes (optional)
+    std::vector<uint32_t> alpha_mixed;                  ///< Bit per triangle, set if it needs alpha tests (empty: test all)
+    std::vector<glm::uvec3> ibo_unclassified;           ///< Index buffer before dropping transparent triangles (empty: none dropped)
     std::shared_ptr<Material> mat;                      ///< Pointer to material
-    std::unique_ptr<Distribution1D> area_distribution;  ///< Area distribution of triangles for importance sampling
+    std::unique_ptr<AliasTable> area_sampler;           ///< Alias table over triangle areas for O(1) importance sampling
+    std::unique_ptr<AliasTable> emission_sampler;       ///< Alias table over emitted power per triangle (light sources only)
+    glm::vec3 emission_integral = glm::vec3(0);         ///< Emission integrated over the surface (without emissive strength)
     glm::vec3 bb_min;                                   ///< AABB (lower left corner)
     glm::vec3 bb_max;                                   ///< AABB (upper right corner)
     glm::vec3 center;                                   ///< Center point of disk approximation
     float radius;                                       ///< Radius of disk approximation
     RTCScene& scene;                                    ///< Embree scene
     std::unique_ptr<AreaLight> area_light;              ///< Area light pointer for handling direct light source hits
+    struct {
+        const Texture* alpha_tex = nullptr;             ///< Alpha map the triangles were classified against
+        bool alpha_mask = false;                        ///< ALPHA_MASK setting at classification
+        const Texture* emission_tex = nullptr;          ///< Texture integrated by the emitter distribution
+        glm::vec3 albedo_col = glm::vec3(0);            ///< Albedo integrated by the emitter distribution (untextured)
+    } derived;                                          ///< Material state the derived data was built from
+
+    // settings
+    inline static bool COMPRESS_ATTRIBUTES = false;     ///< Store normals and texture coords compressed (opt-in)
+    inline static bool PRECOMPUTE_TRIANGLES = false;    ///< Precompute per-triangle shading data (opt-in)
+    inline static bool ALPHA_MASK = true;               ///< Alpha test via 1 bit masks and per-triangle classification
 };
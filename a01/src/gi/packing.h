@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+// ---------------------------------------------
+// octahedral mapping of unit vectors to [-1, 1]^2
+
+inline glm::vec2 octahedral_map(const glm::vec3& n) {
+    const float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if (l1 <= 0.f) return glm::vec2(0); // degenerate vector -> +z
+    glm::vec2 p = glm::vec2(n.x, n.y) / l1;
+    if (n.z < 0.f) // fold lower hemisphere over the diagonals
+        p = (1.f - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f);
+    return p;
+}
+
+inline glm::vec3 octahedral_unmap(const glm::vec2& p) {
+    glm::vec3 n = glm::vec3(p.x, p.y, 1.f - fabsf(p.x) - fabsf(p.y));
+    const float t = fmaxf(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return glm::normalize(n);
+}
+
+// ---------------------------------------------
+// cube map mapping of unit vectors to a face (+x, -x, +y, -y, +z, -z) and [0, 1]^2 within the face
+
+inline glm::vec2 cubemap_map(const glm::vec3& n, uint32_t& face) {
+    const glm::vec3 a = glm::abs(n);
+    float s, t, ma;
+    if (a.x >= a.y && a.x >= a.z) {
+        face = n.x >= 0.f ? 0 : 1;
+        s = n.x >= 0.f ? -n.z : n.z; t = -n.y; ma = a.x;
+    } else if (a.y >= a.z) {
+        face = n.y >= 0.f ? 2 : 3;
+        s = n.x; t = n.y >= 0.f ? n.z : -n.z; ma = a.y;
+    } else {
+        face = n.z >= 0.f ? 4 : 5;
+        s = n.z >= 0.f ? n.x : -n.x; t = -n.y; ma = a.z;
+    }
+    if (ma <= 0.f) return glm::vec2(.5f); // degenerate vector -> center of +x
+    return glm::vec2(s, t) * (.5f / ma) + .5f;
+}
+
+inline glm::vec3 cubemap_unmap(uint32_t face, const glm::vec2& uv) {
+    const float s = 2.f * uv.x - 1.f, t = 2.f * uv.y - 1.f;
+    switch (face) {
+        case 0: return glm::normalize(glm::vec3(1.f, -t, -s));
+        case 1: return glm::normalize(glm::vec3(-1.f, -t, s));
+        case 2: return glm::normalize(glm::vec3(s, 1.f, t));
+        case 3: return glm::normalize(glm::vec3(s, -1.f, -t));
+        case 4: return glm::normalize(glm::vec3(s, -t, 1.f));
+        default: return glm::normalize(glm::vec3(-s, -t, -1.f));
+    }
+}
+
+// ---------------------------------------------
+// octahedral normal encoding (2x16 bit snorm)
+
+inline uint32_t encode_octahedral(const glm::vec3& n) {
+    return glm::packSnorm2x16(octahedral_map(n));
+}
+
+inline glm::vec3 decode_octahedral(uint32_t packed) {
+    return octahedral_unmap(glm::unpackSnorm2x16(packed));
+}
+
+// ---------------------------------------------
+// half float texture coordinates (2x16 bit)
+
+inline uint32_t encode_half2(const glm::vec2& v) {
+    return glm::packHalf2x16(v);
+}
+
+inline glm::vec2 decode_half2(uint32_t packed) {
+    return glm::unpackHalf2x16(packed);
+}
+
+// ---------------------------------------------
+// half float color (3x16 bit), clamped to the largest finite half
+
+inline glm::u16vec3 encode_half3(const glm::vec3& rgb) {
+    return glm::packHalf(glm::min(rgb, glm::vec3(65504.f)));
+}
+
+inline glm::vec3 decode_half3(const glm::u16vec3& packed) {
+    return glm::unpackHalf(packed);
+}
+
+// ---------------------------------------------
+// shared exponent HDR color (RGB9E5, 32 bit)
+
+inline uint32_t encode_rgb9e5(const glm::vec3& rgb) {
+    return glm::packF3x9_E1x5(glm::max(rgb, glm::vec3(0)));
+}
+
+inline glm::vec3 decode_rgb9e5(uint32_t packed) {
+    return glm::unpackF3x9_E1x5(packed);
+}
@@ -74,6 +74,21 @@ public:
     unsigned int instID; ///< Hit instance ID
 };
 
+/**
+ * @brief Offsets of the rays through the neighbouring pixels (Igehy 1999), used to estimate texture footprints
+ * @note Kept separate from Ray, whose layout is shared with Embree.
+ */
+struct RayDifferential {
+    glm::vec3 dOdx = glm::vec3(0);  ///< Origin offset towards the next pixel in x
+    glm::vec3 dOdy = glm::vec3(0);  ///< Origin offset towards the next pixel in y
+    glm::vec3 dDdx = glm::vec3(0);  ///< Direction offset towards the next pixel in x
+    glm::vec3 dDdy = glm::vec3(0);  ///< Direction offset towards the next pixel in y
+
+    inline bool valid() const { return dDdx != glm::vec3(0) || dDdy != glm::vec3(0) || dOdx != glm::vec3(0) || dOdy != glm::vec3(0); }
+    // angular width of the footprint in radians (for unit directions), e.g. for prefiltered environment lookups
+    inline float spread() const { return fmaxf(glm::length(dDdx), glm::length(dDdy)); }
+};
+
 // some helpful embree conversions
 inline RTCRayHit* toRTCRayHit(Ray &ray) { return (RTCRayHit*)&ray; }
 inline RTCRay* toRTCRay(Ray &ray) { return (RTCRay*)&ray; }
@@ -68,6 +68,10 @@ inline float tan_theta(const glm::vec3& N, const glm::vec3& w) {
 inline float tan2_theta(const glm::vec3& N, const glm::vec3& w) {
     return sin2_theta(N, w) / cos2_theta(N, w);
 }
+// cos(max(0, a - b)), given sine and cosine of the angles a and b
+inline float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+    return cos_a > cos_b ? 1.f : cos_a * cos_b + sin_a * sin_b;
+}
 
 // ------------------------------------------------
 // primitive sampling routines
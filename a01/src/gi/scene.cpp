@@ -2,20 +2,61 @@
 #include "ray.h"
 #include "distribution.h"
 #include "light.h"
+#include "light_tree.h"
 #include "material.h"
 #include "mesh.h"
+#include "shape.h"
 #include "timer.h"
 #include "color.h"
 
 #include <cfloat>
 #include <iostream>
+#include <algorithm>
 
 #include <assimp/material.h>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
+// assimp post processing flags used for mesh imports
+static const uint32_t ASS_FLAGS = aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices | aiProcess_OptimizeMeshes;
+
+// cache key of a mesh file, including all settings that change the imported data
+inline AssetKey mesh_key(const std::filesystem::path& resolved_path) {
+    return AssetKey(resolved_path, uint64_t(ASS_FLAGS) | uint64_t(Mesh::COMPRESS_ATTRIBUTES) << 32 | uint64_t(Mesh::PRECOMPUTE_TRIANGLES) << 33);
+}
+
+// ------------------------------------------------
+// MeshAsset
+
+void MeshAsset::attach() {
+    for (auto& mesh : meshes)
+        mesh->attach();
+}
+
+void MeshAsset::detach() {
+    for (auto& mesh : meshes)
+        mesh->detach();
+}
+
+void MeshAsset::reset_materials() {
+    for (size_t i = 0; i < materials.size(); ++i)
+        materials[i]->from_json(material_defaults[i]);
+}
+
+size_t MeshAsset::nbytes() const {
+    size_t total = 0;
+    for (const auto& mesh : meshes)
+        total += mesh->nbytes();
+    for (const auto& mat : materials)
+        total += mat->alpha_mask.nbytes(); // textures are shared and accounted for in the texture cache
+    return total;
+}
+
+// ------------------------------------------------
+// Scene
+
 Scene::Scene(RTCDevice& device)
-    : scene(rtcNewScene(device)), device(device), bb_min(glm::vec3(FLT_MAX)), bb_max(glm::vec3(FLT_MIN)), center(glm::vec3(0.f)), radius(FLT_MIN) {
+    : scene(rtcNewScene(device)), device(device), mesh_cache(size_t(2) << 30), bb_min(glm::vec3(FLT_MAX)), bb_max(glm::vec3(FLT_MIN)), center(glm::vec3(0.f)), radius(FLT_MIN) {
     // possible scene flags:
     // RTC_SCENE_FLAG_NONE, RTC_SCENE_FLAG_DYNAMIC, RTC_SCENE_FLAG_COMPACT
     // RTC_SCENE_FLAG_ROBUST, RTC_SCENE_FLAG_CONTEXT_FILTER_FUNCTION
@@ -27,54 +68,110 @@ Scene::Scene(RTCDevice& device)
 
 Scene::~Scene() {
     clear();
+    mesh_cache.clear();
     rtcReleaseScene(scene);
     importer.FreeScene();
 }
 
 void Scene::clear() {
-    // clear this scene
+    // clear this scene (cached meshes stay in memory, but are no longer traced)
+    for (auto& asset : mesh_assets)
+        asset->detach();
+    mesh_assets.clear();
     mesh_files.clear();
     meshes.clear();
+    shapes.clear();
+    shape_lookup.clear();
     rtcCommitScene(scene);
     materials.clear();
     lights.clear();
     sky.reset();
     light_distribution.reset();
+    light_tree.reset();
     bb_min = glm::vec3(FLT_MAX), bb_max = glm::vec3(FLT_MIN), center = glm::vec3(0);
     radius = FLT_MIN;
+    // enforce memory budgets on whatever is no longer in use
+    mesh_cache.evict();
+    texture_cache().evict();
 }
 
 void Scene::load_mesh(const std::filesystem::path& path) {
     const std::filesystem::path resolved_path = std::filesystem::exists(path) ? path : std::filesystem::path(GI_DATA_DIR) / path;
-    std::cout << "loading: " << path << " (" << resolved_path << ")..." << std::endl;
 
-    const uint32_t ass_flags = aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices | aiProcess_OptimizeMeshes;
-    const aiScene* scene_ai = importer.ReadFile(resolved_path.string().c_str(), ass_flags);
-    if (!scene_ai)
-        throw std::runtime_error("Error: failed to load mesh: " + path.string());
+    // fetch from cache (keyed by file, modification time and import settings)
+    auto [asset, cached] = mesh_cache.get(mesh_key(resolved_path), [&]() {
+        std::cout << "loading: " << path << " (" << resolved_path << ")..." << std::endl;
+        return import_mesh(resolved_path);
+    });
+    if (cached) {
+        if (std::find(mesh_assets.begin(), mesh_assets.end(), asset) != mesh_assets.end()) {
+            // already present in this scene, import another instance
+            std::cout << "loading: " << path << " (" << resolved_path << ")..." << std::endl;
+            asset = import_mesh(resolved_path);
+        } else {
+            std::cout << "reusing: " << path << " (" << resolved_path << ")..." << std::endl;
+            asset->reset_materials();
+            asset->attach();
+        }
+    }
 
     // remember relative path
     mesh_files.push_back(path);
+    mesh_assets.push_back(asset);
+
+    // add materials and meshes
+    materials.insert(materials.end(), asset->materials.begin(), asset->materials.end());
+    for (const auto& mesh : asset->meshes) {
+        meshes.push_back(mesh);
+        // update AABB and radius
+        bb_min = min(bb_min, mesh->bb_min);
+        bb_max = max(bb_max, mesh->bb_max);
+        center = (bb_min + bb_max) * .5f;
+        radius = length(bb_max - bb_min) * .5f;
+    }
+}
+
+std::shared_ptr<MeshAsset> Scene::import_mesh(const std::filesystem::path& path) {
+    const aiScene* scene_ai = importer.ReadFile(path.string().c_str(), ASS_FLAGS);
+    if (!scene_ai)
+        throw std::runtime_error("Error: failed to load mesh: " + path.string());
+
+    auto asset = std::make_shared<MeshAsset>();
 
     // extract materials
-    uint32_t material_offset = materials.size();
-    materials.resize(materials.size() + scene_ai->mNumMaterials);
-    for (uint32_t i = 0; i < scene_ai->mNumMaterials; ++i)
-        materials[material_offset + i] = std::make_shared<Material>(scene_ai->mMaterials[i], resolved_path.parent_path());
+    asset->materials.resize(scene_ai->mNumMaterials);
+    asset->material_defaults.resize(scene_ai->mNumMaterials);
+    for (uint32_t i = 0; i < scene_ai->mNumMaterials; ++i) {
+        asset->materials[i] = std::make_shared<Material>(scene_ai->mMaterials[i], path.parent_path());
+        asset->material_defaults[i] = asset->materials[i]->to_json();
+    }
 
     // extract meshes
-    uint32_t mesh_offset = meshes.size();
-    meshes.resize(meshes.size() + scene_ai->mNumMeshes);
+    asset->meshes.resize(scene_ai->mNumMeshes);
     for (uint32_t i = 0; i < scene_ai->mNumMeshes; ++i) {
         const aiMesh* ai_mesh = scene_ai->mMeshes[i];
-        const auto& mat = materials[material_offset + ai_mesh->mMaterialIndex];
-        meshes[mesh_offset + i] = std::make_shared<Mesh>(device, scene, mat, ai_mesh);
-        // update AABB and radius
-        bb_min = min(bb_min, meshes[mesh_offset + i]->bb_min);
-        bb_max = max(bb_max, meshes[mesh_offset + i]->bb_max);
-        center = (bb_min + bb_max) * .5f;
-        radius = length(bb_max - bb_min) * .5f;
+        asset->meshes[i] = std::make_shared<Mesh>(device, scene, asset->materials[ai_mesh->mMaterialIndex], ai_mesh);
     }
+
+    importer.FreeScene();
+    return asset;
+}
+
+bool Scene::is_resident(const std::vector<std::filesystem::path>& files) {
+    if (files != mesh_files) return false;
+    // procedural meshes and shapes are not part of a config
+    if (!shapes.empty()) return false;
+    size_t num_asset_meshes = 0;
+    for (const auto& asset : mesh_assets)
+        num_asset_meshes += asset->meshes.size();
+    if (num_asset_meshes != meshes.size()) return false;
+    // modified on disk or imported with different settings?
+    for (size_t i = 0; i < files.size(); ++i) {
+        const std::filesystem::path resolved_path = std::filesystem::exists(files[i]) ? files[i] : std::filesystem::path(GI_DATA_DIR) / files[i];
+        if (mesh_cache.find(mesh_key(resolved_path)) != mesh_assets[i])
+            return false;
+    }
+    return true;
 }
 
 void Scene::load_sky(const std::filesystem::path& path, float intensity) {
@@ -92,14 +189,74 @@ void Scene::add(const par_shapes_mesh* par_mesh, const std::shared_ptr<Material>
     radius = length(bb_max - bb_min) * .5f;
 }
 
+std::shared_ptr<Shape> Scene::add_sphere(const glm::vec3& center, float radius, const std::shared_ptr<Material>& mat) {
+    return add(Shape::sphere(device, scene, mat, center, radius));
+}
+
+std::shared_ptr<Shape> Scene::add_disk(const glm::vec3& center, const glm::vec3& normal, float radius, const std::shared_ptr<Material>& mat) {
+    return add(Shape::disk(device, scene, mat, center, normal, radius));
+}
+
+std::shared_ptr<Shape> Scene::add_quad(const glm::vec3& corner, const glm::vec3& edge_u, const glm::vec3& edge_v, const std::shared_ptr<Material>& mat) {
+    return add(Shape::quad(device, scene, mat, corner, edge_u, edge_v));
+}
+
+std::shared_ptr<Shape> Scene::add_shape(const json11::Json& cfg) {
+    auto mat = std::make_shared<Material>();
+    mat->set_to(mat->type);
+    mat->from_json(cfg["material"]);
+    glm::vec3 pos(0), normal(0, 1, 0), edge_u(1, 0, 0), edge_v(0, 0, 1);
+    float radius = 1.f;
+    json_set_float(cfg, "radius", radius);
+    const std::string type = cfg["type"].string_value();
+    if (type == "sphere") {
+        json_set_vec3(cfg, "center", pos);
+        return add_sphere(pos, radius, mat);
+    } else if (type == "disk") {
+        json_set_vec3(cfg, "center", pos);
+        json_set_vec3(cfg, "normal", normal);
+        return add_disk(pos, normal, radius, mat);
+    } else if (type == "quad") {
+        json_set_vec3(cfg, "corner", pos);
+        json_set_vec3(cfg, "edge_u", edge_u);
+        json_set_vec3(cfg, "edge_v", edge_v);
+        return add_quad(pos, edge_u, edge_v, mat);
+    }
+    std::cerr << "Warning: unknown shape type: \"" << type << "\"" << std::endl;
+    return nullptr;
+}
+
+std::shared_ptr<Shape> Scene::add(const std::shared_ptr<Shape>& shape) {
+    shapes.push_back(shape);
+    if (shape->geomID >= shape_lookup.size())
+        shape_lookup.resize(shape->geomID + 1, nullptr);
+    shape_lookup[shape->geomID] = shape.get();
+    // update AABB and radius
+    bb_min = min(bb_min, shape->bb_min);
+    bb_max = max(bb_max, shape->bb_max);
+    center = (bb_min + bb_max) * .5f;
+    radius = length(bb_max - bb_min) * .5f;
+    return shape;
+}
+
 void Scene::commit() {
+    // rebuild data derived from materials patched since the meshes were imported (e.g. resident on config reload)
+    for (auto& mesh : meshes)
+        mesh->update_material();
     // let embree build the BVH
     rtcCommitScene(scene);
     // (re-)select light sources from emissive meshes
     lights.clear();
-    for (auto& mesh : meshes)
-        if (mesh->is_light())
+    for (auto& mesh : meshes) {
+        if (mesh->is_light()) {
+            if (!mesh->emission_sampler)
+                mesh->build_emission_distribution();
             lights.push_back(mesh->area_light.get());
+        }
+    }
+    for (auto& shape : shapes)
+        if (shape->is_light())
+            lights.push_back(shape->light.get());
     if (sky) lights.push_back(sky.get());
     // build distribution for light source importance sampling
     if (!lights.empty()) {
@@ -108,6 +265,10 @@ void Scene::commit() {
             f[i] = luma(lights[i]->power());
         light_distribution.reset(new Distribution1D(f.data(), f.size()));
     }
+    // build light tree for light source selection per shading point
+    light_tree.reset();
+    if (USE_LIGHT_TREE && !lights.empty())
+        light_tree.reset(new LightTree(lights));
 }
 
 const SurfaceInteraction Scene::intersect(Ray &ray) const {
@@ -119,12 +280,20 @@ const SurfaceInteraction Scene::intersect(Ray &ray) const {
         // traverse bvh and return hit
         rtcIntersect1(scene, &context, toRTCRayHit(ray));
     }
-    if (ray)
+    if (ray) {
+        if (const Shape* shape = get_shape(ray.geomID))
+            return SurfaceInteraction(ray, shape);
         return SurfaceInteraction(ray, get_mesh(ray.geomID));
-    else
+    } else
         return SurfaceInteraction(sky.get());
 }
 
+const SurfaceInteraction Scene::intersect(Ray &ray, const RayDifferential& diff) const {
+    SurfaceInteraction hit = intersect(ray);
+    hit.compute_differentials(ray, diff);
+    return hit;
+}
+
 void Scene::intersect(std::vector<Ray> &rays, std::vector<SurfaceInteraction>& hits, bool coherent) const {
     {
         STAT("intersect");
@@ -138,7 +307,9 @@ void Scene::intersect(std::vector<Ray> &rays, std::vector<SurfaceInteraction>& h
         rtcIntersect1M(scene, &context, (RTCRayHit*) rays.data(), rays.size(), sizeof(Ray));
     }
     for (auto& ray : rays) {
-        if (ray)
+        if (ray && get_shape(ray.geomID))
+            hits.emplace_back(ray, get_shape(ray.geomID));
+        else if (ray)
             hits.emplace_back(ray, get_mesh(ray.geomID));
         else
             hits.emplace_back(sky.get());
@@ -158,6 +329,14 @@ bool Scene::occluded(Ray &ray) const {
 }
 
 void Scene::occluded(std::vector<Ray> &rays, std::vector<bool>& hits, bool coherent) const {
+    std::vector<uint64_t> mask((rays.size() + 63) / 64);
+    occluded(rays.data(), rays.size(), mask.data(), coherent);
+    hits.resize(rays.size());
+    for (size_t i = 0; i < rays.size(); ++i)
+        hits[i] = (mask[i / 64] >> (i % 64)) & 1;
+}
+
+void Scene::occluded(Ray* rays, uint32_t N, uint64_t* mask, bool coherent) const {
     {
         STAT("occluded");
         // init context
@@ -166,11 +345,16 @@ void Scene::occluded(std::vector<Ray> &rays, std::vector<bool>& hits, bool coher
         // optimize for coherent or incoherent traversal?
         if (coherent)
             context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
-        // traverse bvh and return hit
-        rtcOccluded1M(scene, &context, (RTCRay*) rays.data(), rays.size(), sizeof(Ray));
+        // traverse bvh for all rays at once
+        rtcOccluded1M(scene, &context, (RTCRay*) rays, N, sizeof(Ray));
+    }
+    // pack results into the bitmask
+    for (uint32_t w = 0; w < (N + 63) / 64; ++w) {
+        uint64_t bits = 0;
+        for (uint32_t i = w * 64; i < std::min(N, (w + 1) * 64); ++i)
+            bits |= uint64_t(rays[i].tfar < 0.f) << (i % 64);
+        mask[w] = bits;
     }
-    for (auto& ray : rays)
-        hits.emplace_back(ray.tfar < 0.f);
 }
 
 std::tuple<const Light*, float> Scene::sample_light_source(float sample) const {
@@ -186,6 +370,18 @@ float Scene::light_source_pdf(const Light* light) const {
     return luma(light->power()) / light_distribution->integral();
 }
 
+std::tuple<const Light*, float> Scene::sample_light_source(const SurfaceInteraction& hit, float sample) const {
+    const auto [light, pdf] = light_tree ? light_tree->sample(hit.P, hit.N, sample) : sample_light_source(sample);
+    // skip light sources that certainly do not contribute before spending a shadow ray
+    if (!light || !light->may_contribute(hit)) return { nullptr, 0.f };
+    return { light, pdf };
+}
+
+float Scene::light_source_pdf(const SurfaceInteraction& hit, const Light* light) const {
+    if (!light_tree) return light_source_pdf(light);
+    return light_tree->pdf(hit.P, hit.N, light);
+}
+
 float Scene::total_light_source_power() const {
     return light_distribution ? light_distribution->integral() : 0.f;
 }
@@ -209,8 +405,12 @@ json11::Json Scene::to_json() const {
     std::vector<std::string> fixed_mesh_files;
     for (auto& path : mesh_files)
         fixed_mesh_files.push_back(fix_data_path(path.string()));
+    std::vector<json11::Json> shape_cfgs;
+    for (auto& shape : shapes)
+        shape_cfgs.push_back(shape->to_json());
     return json11::Json::object{
         { "mesh_files", json11::Json(fixed_mesh_files) },
+        { "shapes", json11::Json(shape_cfgs) },
         { "sky", (sky ? sky->to_json() : json11::Json()) },
         { "materials", json11::Json(mats) }
     };
@@ -218,17 +418,33 @@ json11::Json Scene::to_json() const {
 
 void Scene::from_json(const json11::Json &cfg) {
     if (cfg.is_object()) {
-        // clear current scene
-        clear();
-        // load specified meshes
+        std::vector<std::filesystem::path> files;
         if (cfg["mesh_files"].is_array())
             for (auto &file : cfg["mesh_files"].array_items())
-                load_mesh(file.string_value());
+                files.push_back(file.string_value());
+        if (is_resident(files)) {
+            // same meshes as before: keep geometry and BVH, only undo previous material patches (derived data is updated in commit())
+            for (auto& asset : mesh_assets)
+                asset->reset_materials();
+            lights.clear();
+            sky.reset();
+            light_distribution.reset();
+            light_tree.reset();
+        } else {
+            // clear current scene and load specified meshes (unchanged files are served from the mesh cache)
+            clear();
+            for (auto& file : files)
+                load_mesh(file);
+        }
+        // add analytic shapes (with their own materials)
+        if (cfg["shapes"].is_array())
+            for (auto& shape_json : cfg["shapes"].array_items())
+                add_shape(shape_json);
         // patch materials
         if (cfg["materials"].is_array()) {
             for (auto& mat_json : cfg["materials"].array_items())
                 if (mat_json["name"].is_string())
-                    for (auto& mat_ptr : Material::instances)
+                    for (auto& mat_ptr : materials)
                         if (mat_ptr->name == mat_json["name"].string_value())
                             mat_ptr->from_json(mat_json);
         }
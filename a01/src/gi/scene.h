@@ -12,13 +12,48 @@
 #include "json11.h"
 #include "par_shapes.h"
 #include "surface.h"
+#include "asset_cache.h"
 
 class Ray;
 class Mesh;
+class Shape;
 class Material;
 class Light;
 class SkyLight;
 class Distribution1D;
+class LightTree;
+
+/**
+ * @brief Meshes and materials imported from a single file, kept in the mesh cache across config loads
+ */
+struct MeshAsset {
+    /**
+     * @brief Attach all meshes to their Embree scene
+     */
+    void attach();
+
+    /**
+     * @brief Detach all meshes from their Embree scene
+     */
+    void detach();
+
+    /**
+     * @brief Undo config patches, i.e. restore the materials to their imported state
+     */
+    void reset_materials();
+
+    /**
+     * @brief Query memory held by meshes and material textures
+     *
+     * @return Size in bytes
+     */
+    size_t nbytes() const;
+
+    // data
+    std::vector<std::shared_ptr<Material>> materials;   ///< Imported materials
+    std::vector<json11::Json> material_defaults;        ///< Imported material states
+    std::vector<std::shared_ptr<Mesh>> meshes;          ///< Imported meshes
+};
 
 /**
  * @brief Scene class containing all meshes, light sources and materials in the scene
@@ -52,6 +87,26 @@ public:
 
     void add(const par_shapes_mesh* par_mesh, const std::shared_ptr<Material>& mat);
 
+    /**
+     * @brief Add analytic primitives, traced natively by Embree without tessellation
+     *
+     * @return Pointer to the added shape
+     */
+    std::shared_ptr<Shape> add_sphere(const glm::vec3& center, float radius, const std::shared_ptr<Material>& mat);
+    std::shared_ptr<Shape> add_disk(const glm::vec3& center, const glm::vec3& normal, float radius, const std::shared_ptr<Material>& mat);
+    std::shared_ptr<Shape> add_quad(const glm::vec3& corner, const glm::vec3& edge_u, const glm::vec3& edge_v, const std::shared_ptr<Material>& mat);
+
+    /**
+     * @brief Add an analytic primitive described in JSON, as exported by Shape::to_json, e.g.
+     * { "type": "sphere", "center": [0, 1, 0], "radius": 0.5, "material": { "name": "bulb", "type": "light", "emissive_strength": 10 } }
+     * (disks take "center", "normal" and "radius", quads "corner", "edge_u" and "edge_v")
+     *
+     * @param cfg JSON object describing the shape
+     *
+     * @return Pointer to the added shape, nullptr if the type is unknown
+     */
+    std::shared_ptr<Shape> add_shape(const json11::Json& cfg);
+
     /**
      * @brief Clear all contents of the scene
      */
@@ -74,6 +129,8 @@ public:
      * @return valid SurfaceInteraction class if intersection found, invalid SurfaceInteraction otherwise
      */
     const SurfaceInteraction intersect(Ray &ray) const;
+    // intersection test, additionally computing texture footprints from the ray differentials
+    const SurfaceInteraction intersect(Ray &ray, const RayDifferential& diff) const;
     void intersect(std::vector<Ray>& rays, std::vector<SurfaceInteraction>& hits, bool coherent) const;
 
     /**
@@ -87,6 +144,16 @@ public:
     bool occluded(Ray &ray) const;
     void occluded(std::vector<Ray>& rays, std::vector<bool>& hits, bool coherent) const;
 
+    /**
+     * @brief Perform occlusion tests for a batch of rays in one call
+     *
+     * @param rays Rays to perform the occlusion tests with
+     * @param N Number of rays
+     * @param mask Output bitmask, bit i of mask[i / 64] is set if ray i is occluded (N / 64 rounded up words)
+     * @param coherent Optimize for coherent or incoherent traversal
+     */
+    void occluded(Ray* rays, uint32_t N, uint64_t* mask, bool coherent = false) const;
+
     /**
      * @brief Sample a light source accoring to their respective intensities
      * @note Assumes Scene::commit() has been called previously.
@@ -107,8 +174,34 @@ public:
      */
     float light_source_pdf(const Light* light) const;
 
+    /**
+     * @brief Sample a light source according to its estimated contribution to the given shading point
+     * @note Uses the light tree if enabled, otherwise falls back to selection by intensity.
+     * Light sources failing Light::may_contribute() are rejected.
+     *
+     * @param hit Shading point
+     * @param sample Random sample in [0, 1)
+     *
+     * @return Tuple consisting of:
+     *      - Pointer to sampled light source, nullptr if no light source can contribute (const Light*)
+     *      - Probability of selecting this light source (float)
+     */
+    std::tuple<const Light*, float> sample_light_source(const SurfaceInteraction& hit, float sample) const;
+
+    /**
+     * @brief Query PDF for selecting the given light source at the given shading point
+     *
+     * @param hit Shading point
+     * @param light Light to query PDF for
+     *
+     * @return PDF for selecting this light source
+     */
+    float light_source_pdf(const SurfaceInteraction& hit, const Light* light) const;
+
     inline bool has_sky() const { return sky.operator bool(); }
     inline glm::vec3 Le(const Ray& ray) const { return has_sky() ? sky->Le(ray) : glm::vec3(0.f); }
+    // prefiltered environment lookup for escaped rays with an angular footprint of spread radians
+    inline glm::vec3 Le(const Ray& ray, float spread) const { return has_sky() ? sky->Le(ray, spread) : glm::vec3(0.f); }
 
     /**
      * @brief Query the total power of all light sources present in the scene
@@ -126,10 +219,46 @@ public:
      */
     Mesh* get_mesh(uint32_t geomID) const;
 
+    /**
+     * @brief Translate a geometry ID into a shape pointer, e.g. Ray::geomID
+     *
+     * @param geomID Geometry ID to translate
+     *
+     * @return Shape pointer or nullptr if the geometry is not an analytic shape
+     */
+    inline Shape* get_shape(uint32_t geomID) const { return geomID < shape_lookup.size() ? shape_lookup[geomID] : nullptr; }
+
 private:
     friend class Context;
     friend class json11::Json;
 
+    /**
+     * @brief Add a shape to the scene and the geomID lookup
+     *
+     * @param shape Shape to add
+     *
+     * @return Added shape
+     */
+    std::shared_ptr<Shape> add(const std::shared_ptr<Shape>& shape);
+
+    /**
+     * @brief Import meshes and materials from disk, bypassing the mesh cache
+     *
+     * @param path Resolved path to the mesh file
+     *
+     * @return Imported asset (attached to the Embree scene)
+     */
+    std::shared_ptr<MeshAsset> import_mesh(const std::filesystem::path& path);
+
+    /**
+     * @brief Check if the given mesh files are exactly the ones loaded and unmodified on disk
+     *
+     * @param files Mesh file paths (as given in the config)
+     *
+     * @return true if no meshes have to be (re-)loaded, false otherwise
+     */
+    bool is_resident(const std::vector<std::filesystem::path>& files);
+
     /**
      * @brief Export current state to JSON
      *
@@ -151,13 +280,21 @@ public:
     Assimp::Importer importer;                          ///< Assimp importer
     Assimp::Exporter exporter;                          ///< Assimp exporter
     std::vector<std::filesystem::path> mesh_files;      ///< File paths of present meshes
+    std::vector<std::shared_ptr<MeshAsset>> mesh_assets; ///< Assets of present mesh files
+    AssetCache<MeshAsset> mesh_cache;                   ///< Cache of imported mesh files, for config hot-swapping
     std::vector<std::shared_ptr<Mesh>> meshes;          ///< All present meshes
+    std::vector<std::shared_ptr<Shape>> shapes;         ///< All present analytic shapes
+    std::vector<Shape*> shape_lookup;                   ///< Shapes indexed by geomID (nullptr for meshes)
     std::vector<std::shared_ptr<Material>> materials;   ///< All present materials
     std::shared_ptr<SkyLight> sky;                      ///< Current sky light
     std::shared_ptr<Distribution1D> light_distribution; ///< For importance sampling light sources
+    std::shared_ptr<LightTree> light_tree;              ///< For importance sampling light sources per shading point
     std::vector<Light*> lights;                         ///< All currently relevant light sources
     glm::vec3 bb_min;                                   ///< AABB (lower left corner)
     glm::vec3 bb_max;                                   ///< AABB (upper right corner)
     glm::vec3 center;                                   ///< Center point of disk approximation
     float radius;                                       ///< Radius of disk approximation
+
+    // settings
+    inline static bool USE_LIGHT_TREE = true;           ///< Select light sources per shading point via light tree
 };
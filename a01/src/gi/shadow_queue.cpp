@@ -0,0 +1,21 @@
+#include "shadow_queue.h"
+#include "scene.h"
+#include "framebuffer.h"
+
+void ShadowQueue::push(const Scene& scene, Framebuffer& fbo, const Ray& ray, const glm::vec3& contribution, uint32_t x, uint32_t y) {
+    rays[count] = ray;
+    contributions[count] = contribution;
+    pixels[count] = glm::uvec2(x, y);
+    if (++count == CAPACITY)
+        flush(scene, fbo);
+}
+
+void ShadowQueue::flush(const Scene& scene, Framebuffer& fbo) {
+    if (count == 0) return;
+    scene.occluded(rays.data(), count, occluded.data());
+    for (uint32_t i = 0; i < count; ++i) {
+        const bool blocked = (occluded[i / 64] >> (i % 64)) & 1;
+        fbo.add_sample(pixels[i].x, pixels[i].y, blocked ? glm::vec3(0) : contributions[i]);
+    }
+    count = 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "ray.h"
+
+class Scene;
+class Framebuffer;
+
+/**
+ * @brief Fixed-capacity queue of shadow rays with pending contributions, traced in batches
+ * @note Each entry is one framebuffer sample whose contribution only counts if its shadow ray is unoccluded.
+ * Flushing traces all queued rays at once via Scene::occluded(rays, N, mask) and then commits the samples.
+ * Queues are not thread-safe, use one per thread.
+ */
+class ShadowQueue {
+public:
+    static constexpr uint32_t CAPACITY = 256;
+
+    ShadowQueue() : count(0) {}
+
+    /**
+     * @brief Enqueue a framebuffer sample, flushing the queue if it is full
+     *
+     * @param scene Scene to trace the shadow ray in
+     * @param fbo Framebuffer to commit the sample to
+     * @param ray Shadow ray
+     * @param contribution Sample value if the shadow ray is unoccluded (zero otherwise)
+     * @param x Pixel x coordinate
+     * @param y Pixel y coordinate
+     */
+    void push(const Scene& scene, Framebuffer& fbo, const Ray& ray, const glm::vec3& contribution, uint32_t x, uint32_t y);
+
+    /**
+     * @brief Trace all queued shadow rays and commit their samples to the framebuffer
+     */
+    void flush(const Scene& scene, Framebuffer& fbo);
+
+    inline uint32_t size() const { return count; }
+    inline bool empty() const { return count == 0; }
+
+private:
+    // data
+    uint32_t count;                                     ///< Number of queued shadow rays
+    std::array<Ray, CAPACITY> rays;                     ///< Queued shadow rays
+    std::array<glm::vec3, CAPACITY> contributions;      ///< Contribution of each sample if unoccluded
+    std::array<glm::uvec2, CAPACITY> pixels;            ///< Pixel of each sample
+    std::array<uint64_t, CAPACITY / 64> occluded;       ///< Occlusion bitmask of the last flush
+};
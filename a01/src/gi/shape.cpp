@@ -0,0 +1,140 @@
+#include "shape.h"
+#include "surface.h"
+#include "sampling.h"
+#include <cfloat>
+
+// -------------------------------------------
+// Construction
+
+std::shared_ptr<Shape> Shape::sphere(RTCDevice& device, RTCScene& scene, const std::shared_ptr<Material>& mat, const glm::vec3& center, float radius) {
+    return std::make_shared<Shape>(device, scene, mat, SPHERE, center, glm::vec3(0, 1, 0), glm::vec3(0), glm::vec3(0), radius);
+}
+
+std::shared_ptr<Shape> Shape::disk(RTCDevice& device, RTCScene& scene, const std::shared_ptr<Material>& mat, const glm::vec3& center, const glm::vec3& normal, float radius) {
+    return std::make_shared<Shape>(device, scene, mat, DISK, center, normal, glm::vec3(0), glm::vec3(0), radius);
+}
+
+std::shared_ptr<Shape> Shape::quad(RTCDevice& device, RTCScene& scene, const std::shared_ptr<Material>& mat, const glm::vec3& corner, const glm::vec3& edge_u, const glm::vec3& edge_v) {
+    return std::make_shared<Shape>(device, scene, mat, QUAD, corner, glm::cross(edge_u, edge_v), edge_u, edge_v, 0.f);
+}
+
+inline RTCGeometryType embree_type(Shape::Type type) {
+    switch (type) {
+        case Shape::SPHERE: return RTC_GEOMETRY_TYPE_SPHERE_POINT;
+        case Shape::DISK: return RTC_GEOMETRY_TYPE_ORIENTED_DISC_POINT;
+        default: return RTC_GEOMETRY_TYPE_QUAD;
+    }
+}
+
+Shape::Shape(RTCDevice& device, RTCScene& scene, const std::shared_ptr<Material>& mat, Type type,
+        const glm::vec3& pos, const glm::vec3& normal, const glm::vec3& edge_u, const glm::vec3& edge_v, float radius)
+    : geom(rtcNewGeometry(device, embree_type(type))), geomID(RTC_INVALID_GEOMETRY_ID), type(type), pos(pos),
+    normal(glm::normalize(normal)), edge_u(edge_u), edge_v(edge_v), radius(radius), mat(mat), scene(scene) {
+    switch (type) {
+        case SPHERE:
+            vertex_buf[0] = glm::vec4(pos, radius);
+            rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT4, vertex_buf, 0, sizeof(glm::vec4), 1);
+            area = 4.f * PI * sqr(radius);
+            bb_min = pos - glm::vec3(radius);
+            bb_max = pos + glm::vec3(radius);
+            break;
+        case DISK:
+            std::tie(this->edge_u, this->edge_v) = build_tangent_frame(this->normal);
+            vertex_buf[0] = glm::vec4(pos, radius);
+            normal_buf = glm::vec4(this->normal, 0.f);
+            rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT4, vertex_buf, 0, sizeof(glm::vec4), 1);
+            rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_NORMAL, 0, RTC_FORMAT_FLOAT3, &normal_buf, 0, sizeof(glm::vec4), 1);
+            area = PI * sqr(radius);
+            bb_min = pos - glm::vec3(radius);
+            bb_max = pos + glm::vec3(radius);
+            break;
+        case QUAD:
+            vertex_buf[0] = glm::vec4(pos, 1.f);
+            vertex_buf[1] = glm::vec4(pos + edge_u, 1.f);
+            vertex_buf[2] = glm::vec4(pos + edge_u + edge_v, 1.f);
+            vertex_buf[3] = glm::vec4(pos + edge_v, 1.f);
+            index_buf = glm::uvec4(0, 1, 2, 3);
+            rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, vertex_buf, 0, sizeof(glm::vec4), 4);
+            rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT4, &index_buf, 0, sizeof(glm::uvec4), 1);
+            area = glm::length(glm::cross(edge_u, edge_v));
+            bb_min = glm::vec3(FLT_MAX), bb_max = glm::vec3(-FLT_MAX);
+            for (uint32_t i = 0; i < 4; ++i) {
+                bb_min = glm::min(bb_min, glm::vec3(vertex_buf[i]));
+                bb_max = glm::max(bb_max, glm::vec3(vertex_buf[i]));
+            }
+            break;
+    }
+
+    // set user data pointer
+    rtcSetGeometryUserData(geom, this);
+
+    // commit and attach geometry
+    rtcCommitGeometry(geom);
+    geomID = rtcAttachGeometry(scene, geom);
+
+    // build light source
+    light.reset(new ShapeLight(*this));
+}
+
+Shape::~Shape() {
+    if (geomID != RTC_INVALID_GEOMETRY_ID)
+        rtcDetachGeometry(scene, geomID);
+    rtcReleaseGeometry(geom);
+}
+
+json11::Json Shape::to_json() const {
+    const auto vec = [](const glm::vec3& v) { return json11::Json::array{ v.x, v.y, v.z }; };
+    switch (type) {
+        case SPHERE:
+            return json11::Json::object{ { "type", "sphere" }, { "center", vec(pos) }, { "radius", radius }, { "material", mat->to_json() } };
+        case DISK:
+            return json11::Json::object{ { "type", "disk" }, { "center", vec(pos) }, { "normal", vec(normal) }, { "radius", radius }, { "material", mat->to_json() } };
+        default:
+            return json11::Json::object{ { "type", "quad" }, { "corner", vec(pos) }, { "edge_u", vec(edge_u) }, { "edge_v", vec(edge_v) }, { "material", mat->to_json() } };
+    }
+}
+
+// -------------------------------------------
+// Surface queries
+
+std::tuple<glm::vec3, glm::vec2> Shape::surface_at(const glm::vec3& P) const {
+    const glm::vec3 d = P - pos;
+    switch (type) {
+        case SPHERE: {
+            const glm::vec3 N = glm::normalize(d);
+            const glm::vec2 theta_phi = to_spherical(N);
+            return { N, glm::vec2(theta_phi.y * INV2PI, theta_phi.x * INVPI) };
+        }
+        case DISK:
+            return { normal, glm::vec2(.5f) + .5f * glm::vec2(glm::dot(d, edge_u), glm::dot(d, edge_v)) / radius };
+        default: {
+            // coordinates w.r.t. the (not necessarily orthogonal) edges
+            const glm::vec3 n = glm::cross(edge_u, edge_v);
+            const float inv_n2 = 1.f / glm::dot(n, n);
+            return { normal, glm::vec2(glm::dot(glm::cross(d, edge_v), n), glm::dot(glm::cross(edge_u, d), n)) * inv_n2 };
+        }
+    }
+}
+
+std::tuple<SurfaceInteraction, float> Shape::sample(const glm::vec2& sample) const {
+    STAT("shape surface sample");
+    glm::vec3 P;
+    switch (type) {
+        case SPHERE: {
+            const float z = 1.f - 2.f * sample.x;
+            const float r = sqrtf(fmaxf(0.f, 1.f - sqr(z)));
+            const float phi = 2.f * PI * sample.y;
+            P = pos + radius * glm::vec3(r * cosf(phi), z, r * sinf(phi));
+            break;
+        }
+        case DISK: {
+            const glm::vec2 d = concentric_sample_disk(sample);
+            P = pos + radius * (d.x * edge_u + d.y * edge_v);
+            break;
+        }
+        default:
+            P = pos + sample.x * edge_u + sample.y * edge_v;
+            break;
+    }
+    return { SurfaceInteraction(P, this), 1.f / area };
+}
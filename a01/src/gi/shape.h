@@ -0,0 +1,108 @@
+#pragma once
+#include <tuple>
+#include <memory>
+#include <cstdint>
+#include <embree3/rtcore.h>
+#include <glm/glm.hpp>
+
+#include "material.h"
+#include "light.h"
+
+class ShapeLight;
+class SurfaceInteraction;
+
+/**
+ * @brief Analytic primitive (sphere, disk or quad) traced natively by Embree, without tessellation
+ */
+class Shape {
+public:
+    enum Type { SPHERE, DISK, QUAD };
+
+    /**
+     * @brief Construct a sphere
+     *
+     * @param center Sphere center
+     * @param radius Sphere radius
+     */
+    static std::shared_ptr<Shape> sphere(RTCDevice& device, RTCScene& scene, const std::shared_ptr<Material>& mat, const glm::vec3& center, float radius);
+
+    /**
+     * @brief Construct a disk
+     *
+     * @param center Disk center
+     * @param normal Disk normal (front side)
+     * @param radius Disk radius
+     */
+    static std::shared_ptr<Shape> disk(RTCDevice& device, RTCScene& scene, const std::shared_ptr<Material>& mat, const glm::vec3& center, const glm::vec3& normal, float radius);
+
+    /**
+     * @brief Construct a parallelogram, spanned by two edges from a corner
+     *
+     * @param corner Corner position
+     * @param edge_u First edge (texture coordinate u)
+     * @param edge_v Second edge (texture coordinate v)
+     */
+    static std::shared_ptr<Shape> quad(RTCDevice& device, RTCScene& scene, const std::shared_ptr<Material>& mat, const glm::vec3& corner, const glm::vec3& edge_u, const glm::vec3& edge_v);
+
+    Shape(RTCDevice& device, RTCScene& scene, const std::shared_ptr<Material>& mat, Type type,
+            const glm::vec3& pos, const glm::vec3& normal, const glm::vec3& edge_u, const glm::vec3& edge_v, float radius);
+    ~Shape();
+
+    Shape(const Shape&)            = delete;
+    Shape& operator=(const Shape&) = delete;
+
+    inline float surface_area() const { return area; }
+
+    inline bool is_light() const { assert(mat); return mat->emissive_strength > 0.f; }
+
+    /**
+     * @brief Compute exact geometric normal and texture coordinates at a point on the surface
+     *
+     * @param P Point on the surface
+     *
+     * @return Tuple consisting of:
+     *      - Surface normal (vec3)
+     *      - Texture coordinates (vec2)
+     */
+    std::tuple<glm::vec3, glm::vec2> surface_at(const glm::vec3& P) const;
+
+    /**
+     * @brief Uniformly sample a point on the surface
+     *
+     * @param sample Random sample in [0, 1)
+     *
+     * @return Tuple consisting of:
+     *      - Sampled point on the surface (SurfaceInteraction)
+     *      - PDF of sampled point w.r.t. surface area (float)
+     */
+    std::tuple<SurfaceInteraction, float> sample(const glm::vec2& sample) const;
+
+    /**
+     * @brief Export type, geometry and material to JSON, see Scene::add_shape
+     *
+     * @return Json holding the shape
+     */
+    json11::Json to_json() const;
+
+    // data
+    RTCGeometry geom;                           ///< Embree geometry
+    uint32_t geomID;                            ///< Embree geometry ID
+    Type type;                                  ///< Primitive type
+    glm::vec3 pos;                              ///< Sphere/disk center or quad corner
+    glm::vec3 normal;                           ///< Disk/quad normal
+    glm::vec3 edge_u;                           ///< Quad edge (disk tangent for sphere/disk)
+    glm::vec3 edge_v;                           ///< Quad edge (disk bitangent for sphere/disk)
+    float radius;                               ///< Sphere/disk radius
+    float area;                                 ///< Surface area
+    glm::vec3 bb_min;                           ///< AABB (lower left corner)
+    glm::vec3 bb_max;                           ///< AABB (upper right corner)
+    std::shared_ptr<Material> mat;              ///< Pointer to material
+    RTCScene& scene;                            ///< Embree scene
+    std::unique_ptr<ShapeLight> light;          ///< Light pointer for handling direct light source hits
+
+private:
+    // buffers shared with embree (padded to 16 bytes)
+    glm::vec4 vertex_buf[4];
+    glm::vec4 normal_buf;
+    glm::uvec4 index_buf;
+};
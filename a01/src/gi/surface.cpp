@@ -2,25 +2,44 @@
 #include "brdf.h"
 #include "timer.h"
 
-SurfaceInteraction::SurfaceInteraction(const SkyLight* sky) : valid(false), light(sky) {}
-
-SurfaceInteraction::SurfaceInteraction(const Ray& ray, const Mesh* mesh) : valid(true), mesh(mesh), mat(mesh->mat.get()), light(0) {
-    assert(mesh); assert(mat);
-    STAT("hit point lerp");
-    // fetch indices and baryzentric coords
-    const glm::uvec3& tri = mesh->ibo[ray.primID];
-    const float u = ray.u;
-    const float v = ray.v;
+// interpolate normal and texcoord and fetch primitive area, using the precomputed triangle data if available
+inline void lerp_attributes(const Mesh* mesh, uint32_t primID, float u, float v, glm::vec3& N, glm::vec2& TC, float& area) {
+    if (!mesh->tri_data.empty()) {
+        const TriangleData& t = mesh->tri_data[primID];
+        N = t.N0 + u * t.dN1 + v * t.dN2;
+        if (mesh->has_tcs())
+            TC = t.TC0 + u * decode_half2(t.dTC1) + v * decode_half2(t.dTC2);
+        area = t.area;
+        return;
+    }
+    if (!mesh->tri_data_compact.empty()) {
+        const CompactTriangleData& t = mesh->tri_data_compact[primID];
+        N = (1.f - u - v) * decode_octahedral(t.N[0]) + u * decode_octahedral(t.N[1]) + v * decode_octahedral(t.N[2]);
+        if (mesh->has_tcs())
+            TC = t.TC0 + u * decode_half2(t.dTC1) + v * decode_half2(t.dTC2);
+        area = t.area;
+        return;
+    }
+    const glm::uvec3& tri = mesh->ibo[primID];
     const float w = 1.f - u - v;
-    // compute position
-    P = ray.org + ray.tfar * ray.dir;
     // interpolate normal
-    Ng = w * mesh->normals[tri[0]] + u * mesh->normals[tri[1]] + v * mesh->normals[tri[2]];
+    N = w * mesh->normal(tri[0]) + u * mesh->normal(tri[1]) + v * mesh->normal(tri[2]);
     // interpolate texcoord
-    if (!mesh->tcs.empty())
-        TC = w * mesh->tcs[tri[0]] + u * mesh->tcs[tri[1]] + v * mesh->tcs[tri[2]];
+    if (mesh->has_tcs())
+        TC = w * mesh->tc(tri[0]) + u * mesh->tc(tri[1]) + v * mesh->tc(tri[2]);
     // compute hit primitive area
     area = 0.5 * glm::length(glm::cross(mesh->vbo[tri[1]] - mesh->vbo[tri[0]], mesh->vbo[tri[2]] - mesh->vbo[tri[0]]));
+}
+
+SurfaceInteraction::SurfaceInteraction(const SkyLight* sky) : valid(false), shape(0), light(sky) {}
+
+SurfaceInteraction::SurfaceInteraction(const Ray& ray, const Mesh* mesh) : valid(true), mesh(mesh), shape(0), mat(mesh->mat.get()), light(0) {
+    assert(mesh); assert(mat);
+    STAT("hit point lerp");
+    // compute position
+    P = ray.org + ray.tfar * ray.dir;
+    // interpolate normal and texcoord, fetch hit primitive area
+    lerp_attributes(mesh, ray.primID, ray.u, ray.v, Ng, TC, area);
     // apply normalmapping
     N = mat->normalmap(Ng, TC);
     // light source hit?
@@ -28,7 +47,7 @@ SurfaceInteraction::SurfaceInteraction(const Ray& ray, const Mesh* mesh) : valid
         light = mesh->area_light.get();
 }
 
-SurfaceInteraction::SurfaceInteraction(const glm::vec2& sample, uint32_t primID, const Mesh* mesh) : valid(true), mesh(mesh), mat(mesh->mat.get()), light(0) {
+SurfaceInteraction::SurfaceInteraction(const glm::vec2& sample, uint32_t primID, const Mesh* mesh) : valid(true), mesh(mesh), shape(0), mat(mesh->mat.get()), light(0) {
     assert(mesh); assert(mat);
     STAT("mesh surface sample");
     // fetch indices and baryzentric coords
@@ -39,13 +58,8 @@ SurfaceInteraction::SurfaceInteraction(const glm::vec2& sample, uint32_t primID,
     const float w = 1.f - u - v;
     // interpolate position
     P = w * mesh->vbo[tri[0]] + u * mesh->vbo[tri[1]] + v * mesh->vbo[tri[2]];
-    // interpolate normal
-    Ng = w * mesh->normals[tri[0]] + u * mesh->normals[tri[1]] + v * mesh->normals[tri[2]];
-    // interpolate texcoord
-    if (!mesh->tcs.empty())
-        TC = w * mesh->tcs[tri[0]] + u * mesh->tcs[tri[1]] + v * mesh->tcs[tri[2]];
-    // compute hit primitive area
-    area = 0.5 * glm::length(glm::cross(mesh->vbo[tri[1]] - mesh->vbo[tri[0]], mesh->vbo[tri[2]] - mesh->vbo[tri[0]]));
+    // interpolate normal and texcoord, fetch primitive area
+    lerp_attributes(mesh, primID, u, v, Ng, TC, area);
     // apply normalmapping
     N = mat->normalmap(Ng, TC);
     // light source hit?
@@ -53,8 +67,62 @@ SurfaceInteraction::SurfaceInteraction(const glm::vec2& sample, uint32_t primID,
         light = mesh->area_light.get();
 }
 
+SurfaceInteraction::SurfaceInteraction(const Ray& ray, const Shape* shape)
+    : SurfaceInteraction(ray.org + ray.tfar * ray.dir, shape) {}
+
+SurfaceInteraction::SurfaceInteraction(const glm::vec3& pos, const Shape* shape) : valid(true), P(pos), mesh(0), shape(shape), mat(shape->mat.get()), light(0) {
+    assert(shape); assert(mat);
+    STAT("shape surface lerp");
+    // exact normal and texcoord
+    std::tie(Ng, TC) = shape->surface_at(P);
+    area = shape->surface_area();
+    // apply normalmapping
+    N = mat->normalmap(Ng, TC);
+    // light source hit?
+    if (shape->is_light())
+        light = shape->light.get();
+}
+
 SurfaceInteraction::SurfaceInteraction(const glm::vec3& pos, const glm::vec3& norm)
-    : valid(true), P(pos), Ng(norm), N(norm), TC(0), area(0), mesh(0), mat(0), light(0) {}
+    : valid(true), P(pos), Ng(norm), N(norm), TC(0), area(0), mesh(0), shape(0), mat(0), light(0) {}
+
+void SurfaceInteraction::compute_differentials(const Ray& ray, const RayDifferential& diff) {
+    if (!valid || !mat || !diff.valid()) return;
+    // intersect offset rays with the tangent plane
+    const float d = glm::dot(Ng, P);
+    const glm::vec3 dx_dir = ray.dir + diff.dDdx, dy_dir = ray.dir + diff.dDdy;
+    const float denom_x = glm::dot(Ng, dx_dir), denom_y = glm::dot(Ng, dy_dir);
+    if (fabsf(denom_x) < 1e-8f || fabsf(denom_y) < 1e-8f) return;
+    const glm::vec3 dx_org = ray.org + diff.dOdx, dy_org = ray.org + diff.dOdy;
+    const glm::vec3 Px = dx_org + (d - glm::dot(Ng, dx_org)) / denom_x * dx_dir;
+    const glm::vec3 Py = dy_org + (d - glm::dot(Ng, dy_org)) / denom_y * dy_dir;
+    // texture coordinates at the offset points
+    if (mesh && mesh->has_tcs()) {
+        // barycentric coordinates w.r.t. the hit triangle, extrapolated beyond its edges
+        const glm::uvec3& tri = mesh->ibo[ray.primID];
+        const glm::vec3 e1 = mesh->vbo[tri[1]] - mesh->vbo[tri[0]], e2 = mesh->vbo[tri[2]] - mesh->vbo[tri[0]];
+        const float d11 = glm::dot(e1, e1), d12 = glm::dot(e1, e2), d22 = glm::dot(e2, e2);
+        const float det = d11 * d22 - d12 * d12;
+        if (fabsf(det) < 1e-20f) return;
+        const glm::vec2 t0 = mesh->tc(tri[0]), dt1 = mesh->tc(tri[1]) - t0, dt2 = mesh->tc(tri[2]) - t0;
+        auto tc_at = [&](const glm::vec3& p) {
+            const glm::vec3 v = p - mesh->vbo[tri[0]];
+            const float d1 = glm::dot(v, e1), d2 = glm::dot(v, e2);
+            return t0 + (d22 * d1 - d12 * d2) / det * dt1 + (d11 * d2 - d12 * d1) / det * dt2;
+        };
+        const glm::vec2 tc = tc_at(P);
+        dTCdx = tc_at(Px) - tc;
+        dTCdy = tc_at(Py) - tc;
+    } else if (shape) {
+        // wrap around parameterization seams
+        dTCdx = std::get<1>(shape->surface_at(Px)) - TC;
+        dTCdy = std::get<1>(shape->surface_at(Py)) - TC;
+        dTCdx -= glm::round(dTCdx);
+        dTCdy -= glm::round(dTCdy);
+    } else
+        return;
+    N = mat->normalmap(Ng, TC, dTCdx, dTCdy);
+}
 
 glm::vec3 SurfaceInteraction::brdf(const glm::vec3& w_o, const glm::vec3& w_i) const {
     assert(mat);
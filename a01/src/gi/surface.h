@@ -2,6 +2,7 @@
 #include "light.h"
 #include "material.h"
 #include "mesh.h"
+#include "shape.h"
 #include "ray.h"
 #include "sampling.h"
 #include <cmath>
@@ -34,6 +35,22 @@ public:
      */
     SurfaceInteraction(const glm::vec2& sample, uint32_t primID, const Mesh* mesh);
 
+    /**
+     * @brief Construct as ray surface interaction with an analytic shape
+     *
+     * @param ray Ray that hit something
+     * @param shape Pointer to shape which the ray hit
+     */
+    SurfaceInteraction(const Ray& ray, const Shape* shape);
+
+    /**
+     * @brief Construct as point on an analytic shape, e.g. when sampling a shape light source
+     *
+     * @param pos Position on the shape surface
+     * @param shape Pointer to the shape to be sampled
+     */
+    SurfaceInteraction(const glm::vec3& pos, const Shape* shape);
+
     /**
      * @brief Construct as abstract surface without mesh or material, e.g. a camera sample for BDPT
      *
@@ -48,10 +65,13 @@ public:
     glm::vec3 Ng;        ///< World space geometry normal
     glm::vec3 N;         ///< World space shading normal (including normalmapping)
     glm::vec2 TC;        ///< Texture coordinates, or glm::vec2(0) if none available
+    glm::vec2 dTCdx = glm::vec2(0); ///< Texture coordinate derivative per pixel in x (zero if unknown)
+    glm::vec2 dTCdy = glm::vec2(0); ///< Texture coordinate derivative per pixel in y (zero if unknown)
     float area;          ///< Hit primitive surface area
-    const Mesh* mesh;    ///< Mesh pointer, may be 0 for abstract surfaces
+    const Mesh* mesh;    ///< Mesh pointer, may be 0 for abstract surfaces and shapes
+    const Shape* shape;  ///< Shape pointer, set if an analytic shape was hit
     const Material* mat; ///< Material pointer, may be 0 for abstract surfaces
-    const Light* light;  ///< Light source pointer, set if a light source was hit (type is: valid ? AreaLight : SkyLight)
+    const Light* light;  ///< Light source pointer, set if a light source was hit (type is: valid ? AreaLight/ShapeLight : SkyLight)
 
     /**
      * @brief Evaluate the BRDF of this surface interaction
@@ -95,6 +115,14 @@ public:
      */
     inline Ray spawn_ray(const glm::vec3& dir, float len = FLT_MAX) const { return Ray(P, dir, len); }
 
+    /**
+     * @brief Compute texture coordinate derivatives from the ray differentials of the incoming ray
+     * @note Intersects the offset rays with the tangent plane and re-applies normal mapping with the filtered lookup.
+     *
+     * @param ray Ray that hit this surface
+     * @param diff Differentials of the ray
+     */
+    void compute_differentials(const Ray& ray, const RayDifferential& diff);
     /**
      * @brief Fetch surface color (albedo)
      *
@@ -103,7 +131,7 @@ public:
     inline glm::vec3 albedo() const
     {
         assert(mat);
-        return mat->albedo(TC);
+        return mat->albedo(TC, dTCdx, dTCdy);
     }
 
     /**
@@ -114,7 +142,7 @@ public:
     inline float roughness() const
     {
         assert(mat);
-        return mat->roughness(TC);
+        return mat->roughness(TC, dTCdx, dTCdy);
     }
 
     /**
@@ -132,7 +160,7 @@ public:
     inline glm::vec3 Le() const
     {
         assert(mat);
-        return mat->emissive(TC);
+        return mat->emissive(TC, dTCdx, dTCdy);
     }
 
     /**
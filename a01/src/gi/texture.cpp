@@ -2,14 +2,58 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "texture.h"
 #include "color.h"
+#include "texture_file.h"
 #include <fstream>
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 
 // -------------------------------------------
 // Texture
 
-Texture::Texture() : w(0), h(0), has_alpha(false) {}
+const float Texture::SRGB_LUT[256] = {
+#define L(i) srgb_to_rgb(float(i) / 255.f)
+#define L8(i) L(i), L(i + 1), L(i + 2), L(i + 3), L(i + 4), L(i + 5), L(i + 6), L(i + 7)
+#define L64(i) L8(i), L8(i + 8), L8(i + 16), L8(i + 24), L8(i + 32), L8(i + 40), L8(i + 48), L8(i + 56)
+    L64(0), L64(64), L64(128), L64(192)
+#undef L
+};
+
+const float Texture::LINEAR_LUT[256] = {
+#define L(i) float(i) / 255.f
+    L64(0), L64(64), L64(128), L64(192)
+#undef L
+#undef L8
+#undef L64
+};
+
+size_t Texture::bytes_per_texel(Format format) {
+    switch (format) {
+        case RGBA8: return 4;
+        case R8: return 1;
+        case RGB16F: return 6;
+        case RGB9E5: return 4;
+        default: return sizeof(glm::vec3);
+    }
+}
+
+std::string Texture::format_name(Format format) {
+    switch (format) {
+        case RGBA8: return "rgba8";
+        case R8: return "r8";
+        case RGB16F: return "half";
+        case RGB9E5: return "rgb9e5";
+        default: return "float";
+    }
+}
+
+Texture::Format Texture::parse_format(const std::string& name) {
+    for (Format format : { RGB32F, RGBA8, R8, RGB16F, RGB9E5 })
+        if (name == format_name(format)) return format;
+    throw std::runtime_error("Unknown texture format: " + name);
+}
+
+Texture::Texture() : w(0), h(0), format(RGB32F), lut(LINEAR_LUT), has_alpha(false), paged_level(0), mapped_offset(0) {}
 
 Texture::Texture(const std::filesystem::path& path, bool sRGB) : Texture() {
     load(path, sRGB);
@@ -25,9 +69,64 @@ Texture::Texture(const glm::vec3& col) : Texture() {
 
 void Texture::load(const std::filesystem::path& path, bool sRGB) {
     src_path = path;
+    mips.clear();
+    paged.reset();
+    mapped.reset();
+    if (TileCache::ENABLED && load_paged(path, sRGB))
+        return;
+    if (TextureFile::ENABLED && load_mapped(path, sRGB))
+        return;
+    decode(path, sRGB);
+    if (MIPMAPS) build_mipmaps();
+}
+
+bool Texture::load_mapped(const std::filesystem::path& path, bool sRGB) {
+    const std::filesystem::path file = TextureFile::cache_path(path, sRGB);
+    if (TextureFile::read(*this, file))
+        return true;
+    // convert once, then map the result s.t. the pages are shared with other processes
+    decode(path, sRGB);
+    if (MIPMAPS) build_mipmaps();
+    if (TextureFile::write(*this, file))
+        TextureFile::read(*this, file);
+    return true;
+}
+
+bool Texture::load_paged(const std::filesystem::path& path, bool sRGB) {
+    const std::filesystem::path tiled = TiledImage::cache_path(path, sRGB);
+    std::shared_ptr<TiledImage> image = TiledImage::open(tiled);
+    if (!image) {
+        // convert once, including the full mip chain
+        decode(path, sRGB);
+        build_mipmaps();
+        if (!TiledImage::write(*this, tiled) || !(image = TiledImage::open(tiled)))
+            return true; // keep the decoded texture in memory
+    }
+    // refer to the tiles instead of holding texels
+    std::vector<glm::vec3>().swap(texels);
+    std::vector<uint8_t>().swap(raw);
+    format = RGB32F;
+    mips.clear();
+    mips.resize(image->num_levels() - 1);
+    for (uint32_t l = 0; l < image->num_levels(); ++l) {
+        Texture& level = l == 0 ? *this : mips[l - 1];
+        level.w = image->dim(l).x;
+        level.h = image->dim(l).y;
+        level.src_path = path;
+        level.has_alpha = image->has_alpha();
+        level.paged = image;
+        level.paged_level = l;
+    }
+    return true;
+}
+
+void Texture::decode(const std::filesystem::path& path, bool sRGB) {
     // load image from disk
     int chan_file, chan_forced = 3; // number of color channels
 	bool HDR = stbi_is_hdr(path.string().c_str());
+    format = RGB32F;
+    lut = LINEAR_LUT;
+    raw.clear();
     if (HDR) {
         float* img_data = stbi_loadf(path.string().c_str(), (int*)&w, (int*)&h, &chan_file, chan_forced);
         if (!img_data)
@@ -38,6 +137,26 @@ void Texture::load(const std::filesystem::path& path, bool sRGB) {
             texels[i] = col; // always in linear color space
         }
         stbi_image_free(img_data);
+        convert(HDR_FORMAT);
+    } else if (COMPACT_LDR) {
+        // keep 8 bit texels (with alpha), decoded on fetch
+        uint8_t* img_data = stbi_load(path.string().c_str(), (int*)&w, (int*)&h, &chan_file, 4);
+        if (!img_data)
+            throw std::runtime_error("Failed to load texture: " + path.string());
+        // single channel storage for gray images without alpha (e.g. roughness maps)
+        bool gray = chan_file != 4;
+        for (size_t i = 0; i < w * h && gray; ++i)
+            gray = img_data[i*4+0] == img_data[i*4+1] && img_data[i*4+0] == img_data[i*4+2];
+        format = gray ? R8 : RGBA8;
+        lut = sRGB ? SRGB_LUT : LINEAR_LUT;
+        std::vector<glm::vec3>().swap(texels);
+        if (gray) {
+            raw.resize(w * h);
+            for (size_t i = 0; i < w * h; ++i)
+                raw[i] = img_data[i*4];
+        } else
+            raw.assign(img_data, img_data + w * h * 4);
+        stbi_image_free(img_data);
     } else {
         uint8_t* img_data = stbi_load(path.string().c_str(), (int*)&w, (int*)&h, &chan_file, chan_forced);
         if (!img_data)
@@ -54,9 +173,15 @@ void Texture::load(const std::filesystem::path& path, bool sRGB) {
 
 void Texture::load_alpha(const std::filesystem::path& path) {
     src_path = path;
+    mips.clear();
+    paged.reset();
+    mapped.reset();
     // load image from disk
     int chan_file, chan_forced = 4; // number of color channels
     bool HDR = stbi_is_hdr(path.string().c_str());
+    format = RGB32F;
+    lut = LINEAR_LUT;
+    raw.clear();
     if (HDR) {
         float* img_data = stbi_loadf(path.string().c_str(), (int*)&w, (int*)&h, &chan_file, chan_forced);
         if (!img_data)
@@ -71,18 +196,52 @@ void Texture::load_alpha(const std::filesystem::path& path) {
         uint8_t* img_data = stbi_load(path.string().c_str(), (int*)&w, (int*)&h, &chan_file, chan_forced);
         if (!img_data)
             throw std::runtime_error("Failed to load texture: " + path.string());
-        texels.resize(w * h);
-        for (size_t i = 0; i < w * h; ++i) {
-            const glm::vec3 col = glm::vec3(img_data[i*4+3]) / 255.f;
-            texels[i] = col; // assume alpha to always be in linear space
+        if (COMPACT_LDR) {
+            // single byte per texel, assume alpha to always be in linear space
+            format = R8;
+            std::vector<glm::vec3>().swap(texels);
+            raw.resize(w * h);
+            for (size_t i = 0; i < w * h; ++i)
+                raw[i] = img_data[i*4+3];
+        } else {
+            texels.resize(w * h);
+            for (size_t i = 0; i < w * h; ++i) {
+                const glm::vec3 col = glm::vec3(img_data[i*4+3]) / 255.f;
+                texels[i] = col; // assume alpha to always be in linear space
+            }
         }
         stbi_image_free(img_data);
     }
     has_alpha = chan_file == 4;
+    if (MIPMAPS) build_mipmaps();
+}
+
+void Texture::load_alpha(const Texture& rgba) {
+    if (rgba.format != RGBA8)
+        throw std::runtime_error("Texture has no resident alpha channel: " + rgba.src_path.string());
+    src_path = rgba.src_path;
+    mips.clear();
+    paged.reset();
+    mapped.reset();
+    w = rgba.w;
+    h = rgba.h;
+    format = R8;
+    lut = LINEAR_LUT; // assume alpha to always be in linear space
+    std::vector<glm::vec3>().swap(texels);
+    raw.resize(w * h);
+    for (size_t i = 0; i < w * h; ++i)
+        raw[i] = rgba.raw_data()[4 * i + 3];
+    has_alpha = rgba.has_alpha;
+    if (MIPMAPS) build_mipmaps();
 }
 
 void Texture::load(size_t w, size_t h, const glm::vec3* data) {
     src_path.clear();
+    mips.clear();
+    paged.reset();
+    mapped.reset();
+    format = RGB32F;
+    raw.clear();
     this->w = w;
     this->h = h;
     texels.resize(w * h);
@@ -92,18 +251,122 @@ void Texture::load(size_t w, size_t h, const glm::vec3* data) {
 
 void Texture::load(const glm::vec3& col) {
     src_path.clear();
+    mips.clear();
+    paged.reset();
+    mapped.reset();
+    format = RGB32F;
+    raw.clear();
     w = 1;
     h = 1;
     texels.resize(1);
     texels[0] = col;
 }
 
+void Texture::build_mipmaps() {
+    if (paged) return; // mip levels are part of the tiled image
+    mips.clear();
+    size_t n_levels = 0;
+    for (size_t lw = w, lh = h; lw > 1 || lh > 1; lw = std::max<size_t>(1, lw / 2), lh = std::max<size_t>(1, lh / 2))
+        n_levels++;
+    mips.reserve(n_levels); // keeps references to the previous level valid
+    for (size_t l = 0; l < n_levels; ++l) {
+        const Texture& src = level(l);
+        Texture mip;
+        mip.w = std::max<size_t>(1, src.w / 2);
+        mip.h = std::max<size_t>(1, src.h / 2);
+        mip.src_path = src_path;
+        mip.has_alpha = has_alpha;
+        mip.format = format;
+        mip.lut = lut;
+        if (format == RGB32F)
+            mip.texels.resize(mip.w * mip.h);
+        else
+            mip.raw.resize(mip.w * mip.h * bytes_per_texel(format));
+        // 2x2 box filter on decoded texels, odd trailing rows/columns are dropped
+        #pragma omp parallel for
+        for (int y = 0; y < int(mip.h); ++y) {
+            const size_t y0 = std::min<size_t>(2 * y, src.h - 1), y1 = std::min<size_t>(2 * y + 1, src.h - 1);
+            for (size_t x = 0; x < mip.w; ++x) {
+                const size_t x0 = std::min<size_t>(2 * x, src.w - 1), x1 = std::min<size_t>(2 * x + 1, src.w - 1);
+                const size_t i00 = y0 * src.w + x0, i01 = y0 * src.w + x1, i10 = y1 * src.w + x0, i11 = y1 * src.w + x1;
+                mip.store(y * mip.w + x, .25f * (src.texel(i00) + src.texel(i01) + src.texel(i10) + src.texel(i11)));
+                if (format == RGBA8) {
+                    const uint8_t* a = src.raw_data() + 3;
+                    mip.raw[4 * (y * mip.w + x) + 3] = (int(a[4 * i00]) + a[4 * i01] + a[4 * i10] + a[4 * i11] + 2) / 4;
+                }
+            }
+        }
+        mips.push_back(std::move(mip));
+    }
+}
+
+void Texture::store(size_t i, const glm::vec3& col) {
+    const auto quantize = [this](float val) {
+        return uint8_t(glm::clamp(int(roundf((lut == SRGB_LUT ? rgb_to_srgb(val) : val) * 255)), 0, 255));
+    };
+    switch (format) {
+        case RGBA8:
+            for (int c = 0; c < 3; ++c)
+                raw[4 * i + c] = quantize(col[c]);
+            break;
+        case R8:
+            raw[i] = quantize(col.x);
+            break;
+        case RGB16F: {
+            const glm::u16vec3 packed = encode_half3(col);
+            memcpy(&raw[6 * i], &packed, sizeof(packed));
+            break;
+        }
+        case RGB9E5: {
+            const uint32_t packed = encode_rgb9e5(col);
+            memcpy(&raw[4 * i], &packed, sizeof(packed));
+            break;
+        }
+        default:
+            texels[i] = col;
+    }
+}
+
+void Texture::convert(Format target) {
+    if (paged || format == target) return;
+    Texture dst;
+    dst.format = target;
+    dst.lut = format == RGBA8 || format == R8 ? lut : LINEAR_LUT;
+    if (target == RGB32F)
+        dst.texels.resize(w * h);
+    else
+        dst.raw.resize(w * h * bytes_per_texel(target));
+    #pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(w) * h; ++i) {
+        dst.store(i, texel(i));
+        if (target == RGBA8)
+            dst.raw[4 * i + 3] = format == RGBA8 ? raw_data()[4 * i + 3] : 255;
+    }
+    texels.swap(dst.texels);
+    raw.swap(dst.raw);
+    mapped.reset();
+    format = target;
+    lut = dst.lut;
+    for (Texture& mip : mips)
+        mip.convert(target);
+}
+
 void Texture::save_png(const std::filesystem::path& path) const {
-    Texture::save_png(path, w, h, data());
+    if (format == RGB32F && !paged) return Texture::save_png(path, w, h, data());
+    std::vector<glm::vec3> rgb(w * h);
+    for (size_t y = 0; y < h; ++y)
+        for (size_t x = 0; x < w; ++x)
+            rgb[y * w + x] = fetch(glm::uvec2(x, y));
+    Texture::save_png(path, w, h, rgb.data());
 }
 
 void Texture::save_jpg(const std::filesystem::path& path) const {
-    Texture::save_jpg(path, w, h, data());
+    if (format == RGB32F && !paged) return Texture::save_jpg(path, w, h, data());
+    std::vector<glm::vec3> rgb(w * h);
+    for (size_t y = 0; y < h; ++y)
+        for (size_t x = 0; x < w; ++x)
+            rgb[y * w + x] = fetch(glm::uvec2(x, y));
+    Texture::save_jpg(path, w, h, rgb.data());
 }
 
 void Texture::save_png(const std::filesystem::path& path, size_t w, size_t h, const glm::vec3* rgb, bool flip) {
@@ -127,3 +390,107 @@ void Texture::save_jpg(const std::filesystem::path& path, size_t w, size_t h, co
     stbi_write_jpg(path.string().c_str(), w, h, 3, pixels.data(), 100);
     printf("%s written.\n", path.string().c_str());
 }
+
+// -------------------------------------------
+// TextureStats
+
+std::vector<std::unordered_map<const Texture*, TextureStats::Counters>> TextureStats::per_thread(omp_get_max_threads());
+
+void TextureStats::Counters::merge(const Counters& other, uint32_t level_offset) {
+    lookups += other.lookups;
+    fetches += other.fetches;
+    for (uint32_t l = 0; l < MAX_LEVELS; ++l)
+        levels[std::min(l + level_offset, MAX_LEVELS - 1)] += other.levels[l];
+}
+
+std::unordered_map<const Texture*, TextureStats::Counters> TextureStats::collect() {
+    std::unordered_map<const Texture*, Counters> merged;
+    for (const auto& counters : per_thread)
+        for (const auto& [tex, c] : counters)
+            merged[tex].merge(c);
+    return merged;
+}
+
+void TextureStats::clear() {
+    for (auto& counters : per_thread)
+        counters.clear();
+}
+
+// -------------------------------------------
+// AlphaMask
+
+void AlphaMask::build(const Texture& alpha) {
+    w = alpha.width();
+    h = alpha.height();
+    bits.assign((size_t(w) * h + 63) / 64, 0);
+    num_opaque = 0;
+    #pragma omp parallel for reduction(+ : num_opaque)
+    for (int64_t b = 0; b < int64_t(bits.size()); ++b) {
+        uint64_t word = 0;
+        for (size_t i = b * 64; i < std::min<size_t>((b + 1) * 64, size_t(w) * h); ++i) {
+            if (luma(alpha.fetch(glm::uvec2(i % w, i / w))) >= THRESHOLD) {
+                word |= uint64_t(1) << (i & 63);
+                num_opaque++;
+            }
+        }
+        bits[b] = word;
+    }
+}
+
+void AlphaMask::clear() {
+    w = h = 0;
+    std::vector<uint64_t>().swap(bits);
+    num_opaque = 0;
+}
+
+AlphaMask::Coverage AlphaMask::classify(const glm::vec2& TC0, const glm::vec2& TC1, const glm::vec2& TC2) const {
+    if (num_opaque == size_t(w) * h) return OPAQUE;
+    if (num_opaque == 0) return TRANSPARENT;
+    // nearest texels of all lookups within the triangle lie in the texel bounding box of its texture coordinates
+    const glm::vec2 dim(w, h);
+    const glm::vec2 lo = glm::floor(glm::min(TC0, glm::min(TC1, TC2)) * dim);
+    const glm::vec2 hi = glm::floor(glm::max(TC0, glm::max(TC1, TC2)) * dim);
+    if (!std::isfinite(lo.x) || !std::isfinite(lo.y) || !std::isfinite(hi.x) || !std::isfinite(hi.y) ||
+            (double(hi.x - lo.x) + 1) * (double(hi.y - lo.y) + 1) > MAX_CLASSIFY)
+        return MIXED;
+    bool opaque = false, transparent = false;
+    for (int64_t y = int64_t(lo.y); y <= int64_t(hi.y); ++y) {
+        const size_t row = size_t(((y % h) + h) % h) * w;
+        for (int64_t x = int64_t(lo.x); x <= int64_t(hi.x); ++x) {
+            const size_t i = row + size_t(((x % w) + w) % w);
+            if ((bits[i >> 6] >> (i & 63)) & 1) opaque = true; else transparent = true;
+            if (opaque && transparent) return MIXED;
+        }
+    }
+    return opaque ? OPAQUE : TRANSPARENT;
+}
+
+// -------------------------------------------
+// Debugging
+
+void debug_texture_formats(const Texture& tex) {
+    Texture ref = tex;
+    ref.convert(Texture::RGB32F);
+    for (Texture::Format format : { Texture::RGB16F, Texture::RGB9E5 }) {
+        Texture compact = ref;
+        compact.convert(format);
+        // relative error per texel and of bilinear lookups in between texels
+        double sum_texel = 0, sum_bilin = 0;
+        float max_texel = 0;
+        for (size_t y = 0; y < ref.height(); ++y) {
+            for (size_t x = 0; x < ref.width(); ++x) {
+                const glm::vec3 a = ref.fetch(glm::uvec2(x, y)), b = compact.fetch(glm::uvec2(x, y));
+                const float err = luma(glm::abs(a - b)) / fmaxf(1e-4f, luma(a));
+                sum_texel += err;
+                max_texel = fmaxf(max_texel, err);
+                const glm::vec2 uv = (glm::vec2(x, y) + .37f) / glm::vec2(ref.dim());
+                const glm::vec3 c = ref.bilin(uv), d = compact.bilin(uv);
+                sum_bilin += luma(glm::abs(c - d)) / fmaxf(1e-4f, luma(c));
+            }
+        }
+        const size_t n = std::max<size_t>(1, ref.width() * ref.height());
+        std::cout << "Texture format " << Texture::format_name(format) << " (" << tex.path() << "): "
+            << ref.nbytes() / double(1 << 20) << "MB -> " << compact.nbytes() / double(1 << 20) << "MB, avg rel error: "
+            << sum_texel / n << ", max rel error: " << max_texel << ", avg rel error (bilinear): " << sum_bilin / n << std::endl;
+    }
+}
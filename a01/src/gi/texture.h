@@ -1,14 +1,36 @@
 #pragma once
 
+#include <string>
+#include <vector>
+#include <unordered_map>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <glm/glm.hpp>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <stb_image.h>
 #include <stb_image_write.h>
 #include "timer.h"
+#include "packing.h"
+#include "tile_cache.h"
+#include "mapped_file.h"
 
 class Texture {
 public:
+    // texel storage formats
+    enum Format {
+        RGB32F,     ///< 3 x 32 bit float (texels)
+        RGBA8,      ///< 4 x 8 bit, decoded via lut (raw)
+        R8,         ///< 1 x 8 bit, replicated to rgb, decoded via lut (raw)
+        RGB16F,     ///< 3 x 16 bit half float (raw)
+        RGB9E5,     ///< 3 x 9 bit mantissa with shared 5 bit exponent, 32 bit (raw)
+    };
+    static size_t bytes_per_texel(Format format);
+    static std::string format_name(Format format);
+    static Format parse_format(const std::string& name);
+
     // construct invalid texture
     Texture();
     // construct from file on disk
@@ -22,6 +44,8 @@ public:
     void load(const std::filesystem::path& path, bool sRGB = true);
     // load alpha channel of texture from disk
     void load_alpha(const std::filesystem::path& path);
+    // extract alpha channel of a resident RGBA8 texture (without decoding the image again)
+    void load_alpha(const Texture& rgba);
     // load texture from given texel data
     void load(size_t w, size_t h, const glm::vec3* data);
     // load 1x1 texture with given color
@@ -30,8 +54,25 @@ public:
     // texture lookups
     inline glm::vec3 fetch(const glm::uvec2& xy) const;
     inline glm::vec3 bilin(const glm::vec2& uv) const;
+    // four bilinear lookups at once (address computation for all of them in SIMD registers)
+    inline void bilin4(const glm::vec2 uv[4], glm::vec3 result[4]) const;
     inline glm::vec3 env(const glm::vec3& dir) const;
 
+    // mip mapped lookups (level 0 is the texture itself, lod is clamped to the available levels)
+    inline glm::vec3 trilin(const glm::vec2& uv, float lod) const;
+    // level of detail for a footprint given via texture coordinate derivatives (-inf for an empty footprint)
+    inline float lod(const glm::vec2& dUVdx, const glm::vec2& dUVdy) const;
+    // trilinear lookup with level of detail from texture coordinate derivatives
+    inline glm::vec3 filtered(const glm::vec2& uv, const glm::vec2& dUVdx, const glm::vec2& dUVdy) const { return trilin(uv, lod(dUVdx, dUVdy)); }
+    inline glm::vec3 env(const glm::vec3& dir, float lod) const;
+
+    // build box filtered mip levels down to 1x1 (in parallel), replacing existing ones (no-op for paged textures)
+    void build_mipmaps();
+    inline size_t levels() const { return 1 + mips.size(); }
+    // re-encode the resident texels (and mip levels) into the given storage format (no-op for paged textures)
+    void convert(Format target);
+    inline const Texture& level(size_t l) const { return l == 0 || mips.empty() ? *this : mips[std::min(l, mips.size()) - 1]; }
+
     // check if texture is valid and it is save to perform texture lookups
     inline explicit operator bool() const { return w != 0 && h != 0; }
 
@@ -47,9 +88,38 @@ public:
     inline size_t width() const { return w; }
     inline size_t height() const { return h; }
     inline glm::uvec2 dim() const { return glm::uvec2(w, h); }
-    inline const glm::vec3* data() const { return texels.data(); }
+    inline const glm::vec3* data() const { return mapped ? (const glm::vec3*)(mapped->data() + mapped_offset) : texels.data(); }
+    inline const uint8_t* raw_data() const { return mapped ? mapped->data() + mapped_offset : raw.data(); }
+    inline Format storage_format() const { return format; }
     inline std::filesystem::path path() const { return src_path; }
+    inline bool is_paged() const { return paged.operator bool(); }
+    inline bool is_mapped() const { return mapped.operator bool(); }
+    // resident bytes (mapped files are shared page cache and not accounted for)
+    inline size_t nbytes() const {
+        size_t n = texels.size() * sizeof(glm::vec3) + raw.size() + (paged && paged_level == 0 ? paged->nbytes() : 0);
+        for (const Texture& mip : mips) n += mip.nbytes();
+        return n;
+    }
+
+private:
+    // texel at wrapped coordinates, resident or paged (without statistics)
+    inline glm::vec3 texel_at(const glm::uvec2& xy) const;
+    // bilinear lookup (without statistics)
+    inline glm::vec3 sample(const glm::vec2& uv) const;
+    // decode a resident texel of the current format
+    inline glm::vec3 texel(size_t i) const;
+    // bilinear blend of the resident 2x2 footprint at i, i + dx, i + dy and i + dx + dy
+    inline glm::vec3 footprint(size_t i, ptrdiff_t dx, ptrdiff_t dy, const glm::vec2& f) const;
+    // encode a linear color into a resident texel of the current format (alpha is kept as is)
+    void store(size_t i, const glm::vec3& col);
+    // decode image from disk into texels (rgb and alpha, if present)
+    void decode(const std::filesystem::path& path, bool sRGB);
+    // attach the tiled version of an image from the TileCache directory, converting it on first use
+    bool load_paged(const std::filesystem::path& path, bool sRGB);
+    // map the preconverted version of an image from the TextureFile directory, converting it on first use
+    bool load_mapped(const std::filesystem::path& path, bool sRGB);
 
+public:
     // save as PNG / JPG
     void save_png(const std::filesystem::path& path) const;
     void save_jpg(const std::filesystem::path& path) const;
@@ -61,30 +131,252 @@ public:
     // data
     size_t w;                       ///< Texture width
     size_t h;                       ///< Texture height
-    std::vector<glm::vec3> texels;  ///< Raw texel data
+    std::vector<glm::vec3> texels;  ///< Texel data (RGB32F)
+    std::vector<uint8_t> raw;       ///< Packed texel data (compact formats)
+    Format format;                  ///< Storage format
+    const float* lut;               ///< 8 bit to linear float decoding table (RGBA8, R8)
     std::filesystem::path src_path; ///< Filename, if loaded from disk
-    bool has_alpha;                 ///< Image from disk had alpha channel (which was discarded on loading)
+    bool has_alpha;                 ///< Image from disk had alpha channel (kept in RGBA8 storage only)
+    std::vector<Texture> mips;      ///< Mip levels 1..n, empty if not mip mapped
+    std::shared_ptr<TiledImage> paged; ///< Demand-paged tiled storage (texels are empty then), see TileCache
+    uint32_t paged_level;           ///< Mip level of the tiled image this texture refers to
+    std::shared_ptr<MappedFile> mapped; ///< Preconverted file holding the texels (texels and raw are empty then), see TextureFile
+    size_t mapped_offset;           ///< Offset of this level's texels in the mapped file
+
+    // settings
+    inline static bool MIPMAPS = true;  ///< Build mip chains when loading textures from disk
+    inline static bool COMPACT_LDR = true; ///< Keep LDR images as 8 bit texels, decoded on fetch
+    inline static bool STATS = false;   ///< Count lookups per texture and mip level, see TextureStats
+    inline static Format HDR_FORMAT = RGB32F; ///< Storage format of HDR images loaded from disk
+
+    // decoding tables for 8 bit storage
+    static const float SRGB_LUT[256];
+    static const float LINEAR_LUT[256];
+};
+
+/**
+ * @brief Optional per-texture lookup statistics (see Texture::STATS), gathered in per-thread counters
+ * @note Counters are keyed by the Texture object a lookup was issued on, i.e. direct lookups of mip levels count separately.
+ */
+class TextureStats {
+public:
+    static constexpr uint32_t MAX_LEVELS = 16;
+
+    struct Counters {
+        uint64_t lookups = 0;               ///< Point, bilinear and trilinear lookups
+        uint64_t fetches = 0;               ///< Texels read
+        uint64_t levels[MAX_LEVELS] = {};   ///< Lookups per (finer) mip level read, coarser levels are clamped
+
+        void merge(const Counters& other, uint32_t level_offset = 0);
+    };
+
+    // count a lookup reading the given number of texels at a mip level of a texture
+    static inline void record(const Texture* tex, uint32_t level, uint32_t fetches);
+
+    // merge the counters of all threads
+    static std::unordered_map<const Texture*, Counters> collect();
+    // reset all counters
+    static void clear();
+
+private:
+    static std::vector<std::unordered_map<const Texture*, Counters>> per_thread; ///< Counters per OMP thread
+};
+
+/**
+ * @brief One bit per texel alpha mask for cheap alpha tests with nearest texel lookups
+ */
+class AlphaMask {
+public:
+    enum Coverage { OPAQUE, TRANSPARENT, MIXED };
+
+    // build from an alpha texture, texels with luma below THRESHOLD are transparent
+    void build(const Texture& alpha);
+    // release the mask
+    void clear();
+
+    // alpha test for the texel nearest to TC (wrapping)
+    inline bool test(const glm::vec2& TC) const;
+
+    /**
+     * @brief Conservatively classify a triangle via the texels covered by the bounding box of its texture coordinates
+     *
+     * @return OPAQUE or TRANSPARENT if all nearest texel lookups within the triangle agree, MIXED otherwise
+     */
+    Coverage classify(const glm::vec2& TC0, const glm::vec2& TC1, const glm::vec2& TC2) const;
+
+    inline explicit operator bool() const { return w != 0 && h != 0; }
+    inline size_t nbytes() const { return bits.size() * sizeof(uint64_t); }
+
+    // data
+    uint32_t w = 0, h = 0;          ///< Mask dimensions
+    std::vector<uint64_t> bits;     ///< Row-major bits, set for opaque texels
+    size_t num_opaque = 0;          ///< Number of opaque texels
+
+    static constexpr float THRESHOLD = .1f;             ///< Alpha threshold
+    static constexpr size_t MAX_CLASSIFY = 1 << 16;     ///< Larger footprints are classified as MIXED (unless uniform)
 };
 
 // --------------------------------------
 // inline implementations
 
+void TextureStats::record(const Texture* tex, uint32_t level, uint32_t fetches) {
+    const size_t thread = omp_get_thread_num();
+    if (thread >= per_thread.size()) return;
+    Counters& counters = per_thread[thread][tex];
+    counters.lookups++;
+    counters.fetches += fetches;
+    counters.levels[std::min(level, MAX_LEVELS - 1)]++;
+}
+
+bool AlphaMask::test(const glm::vec2& TC) const {
+    const glm::vec2 uv = glm::fract(TC);
+    const uint32_t x = std::min(uint32_t(uv.x * w), w - 1), y = std::min(uint32_t(uv.y * h), h - 1);
+    const size_t i = size_t(y) * w + x;
+    return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+glm::vec3 Texture::texel(size_t i) const {
+    switch (format) {
+        case RGBA8: {
+            const uint8_t* p = raw_data() + 4 * i;
+            return glm::vec3(lut[p[0]], lut[p[1]], lut[p[2]]);
+        }
+        case R8:
+            return glm::vec3(lut[raw_data()[i]]);
+        case RGB16F: {
+            glm::u16vec3 packed;
+            std::memcpy(&packed, raw_data() + 6 * i, sizeof(packed));
+            return decode_half3(packed);
+        }
+        case RGB9E5: {
+            uint32_t packed;
+            std::memcpy(&packed, raw_data() + 4 * i, sizeof(packed));
+            return decode_rgb9e5(packed);
+        }
+        default:
+            return data()[i];
+    }
+}
+
+// bilinear interpolation (in SIMD registers, if available)
+inline glm::vec3 blend_bilin(const glm::vec3& bl, const glm::vec3& br, const glm::vec3& tl, const glm::vec3& tr, const glm::vec2& f) {
+#if defined(__SSE2__)
+    const __m128 a = _mm_setr_ps(bl.x, bl.y, bl.z, 0.f), b = _mm_setr_ps(br.x, br.y, br.z, 0.f);
+    const __m128 c = _mm_setr_ps(tl.x, tl.y, tl.z, 0.f), d = _mm_setr_ps(tr.x, tr.y, tr.z, 0.f);
+    const __m128 fx = _mm_set1_ps(f.x), fy = _mm_set1_ps(f.y);
+    const __m128 bottom = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), fx));
+    const __m128 top = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), fx));
+    alignas(16) float res[4];
+    _mm_store_ps(res, _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(top, bottom), fy)));
+    return glm::vec3(res[0], res[1], res[2]);
+#else
+    return glm::mix(glm::mix(bl, br, f.x), glm::mix(tl, tr, f.x), f.y);
+#endif
+}
+
 glm::vec3 Texture::fetch(const glm::uvec2& xy) const {
     STAT("Texture lookup");
-    return texels[(xy.y % h) * w + (xy.x % w)];
+    if (STATS) TextureStats::record(this, 0, 1);
+    return texel_at(xy);
+}
+
+glm::vec3 Texture::texel_at(const glm::uvec2& xy) const {
+    // bitmask instead of modulo for power of two dimensions
+    const uint32_t x = (w & (w - 1)) == 0 ? xy.x & (w - 1) : xy.x % w;
+    const uint32_t y = (h & (h - 1)) == 0 ? xy.y & (h - 1) : xy.y % h;
+    if (paged) return paged->fetch(paged_level, x, y);
+    return texel(size_t(y) * w + x);
+}
+
+glm::vec3 Texture::footprint(size_t i, ptrdiff_t dx, ptrdiff_t dy, const glm::vec2& f) const {
+    const size_t idx[4] = { i, i + dx, i + dy, i + dx + dy };
+    glm::vec3 t[4];
+    switch (format) {
+        case RGB32F: {
+            const glm::vec3* base = data();
+            for (int k = 0; k < 4; ++k) t[k] = base[idx[k]];
+            break;
+        }
+        case RGBA8: {
+            const uint8_t* base = raw_data();
+            for (int k = 0; k < 4; ++k) {
+                const uint8_t* p = base + 4 * idx[k];
+                t[k] = glm::vec3(lut[p[0]], lut[p[1]], lut[p[2]]);
+            }
+            break;
+        }
+        default:
+            for (int k = 0; k < 4; ++k) t[k] = texel(idx[k]);
+    }
+    return blend_bilin(t[0], t[1], t[2], t[3], f);
 }
 
 glm::vec3 Texture::bilin(const glm::vec2& uv) const {
-    assert(std::isfinite(uv.x) && std::isfinite(uv.y));
     STAT("Texture lookup");
+    if (STATS) TextureStats::record(this, 0, 4);
+    return sample(uv);
+}
+
+glm::vec3 Texture::sample(const glm::vec2& uv) const {
+    assert(std::isfinite(uv.x) && std::isfinite(uv.y));
     const glm::vec2 uv_map = glm::fract(uv);
     const glm::vec2 xy = uv_map * glm::vec2(w, h);
-    const glm::vec3 bl = fetch(glm::uvec2(xy) + glm::uvec2(0, 0));
-    const glm::vec3 br = fetch(glm::uvec2(xy) + glm::uvec2(1, 0));
-    const glm::vec3 tl = fetch(glm::uvec2(xy) + glm::uvec2(0, 1));
-    const glm::vec3 tr = fetch(glm::uvec2(xy) + glm::uvec2(1, 1));
     const glm::vec2 f = glm::fract(xy);
-    return glm::mix(glm::mix(bl, br, f.x), glm::mix(tl, tr, f.x), f.y);
+    if (paged) {
+        const glm::vec3 bl = texel_at(glm::uvec2(xy) + glm::uvec2(0, 0));
+        const glm::vec3 br = texel_at(glm::uvec2(xy) + glm::uvec2(1, 0));
+        const glm::vec3 tl = texel_at(glm::uvec2(xy) + glm::uvec2(0, 1));
+        const glm::vec3 tr = texel_at(glm::uvec2(xy) + glm::uvec2(1, 1));
+        return blend_bilin(bl, br, tl, tr, f);
+    }
+    // single address computation for the 2x2 footprint, wrapping at the borders without integer division
+    uint32_t x0 = uint32_t(xy.x), y0 = uint32_t(xy.y);
+    if (x0 >= w) x0 -= w;
+    if (y0 >= h) y0 -= h;
+    const ptrdiff_t dx = x0 + 1 < w ? 1 : 1 - ptrdiff_t(w);
+    const ptrdiff_t dy = y0 + 1 < h ? ptrdiff_t(w) : -ptrdiff_t(w) * ptrdiff_t(h - 1);
+    return footprint(size_t(y0) * w + x0, dx, dy, f);
+}
+
+void Texture::bilin4(const glm::vec2 uv[4], glm::vec3 result[4]) const {
+#if defined(__SSE2__)
+    if (!paged) {
+        STAT("Texture lookup");
+        const __m128 u = _mm_setr_ps(uv[0].x, uv[1].x, uv[2].x, uv[3].x);
+        const __m128 v = _mm_setr_ps(uv[0].y, uv[1].y, uv[2].y, uv[3].y);
+        const auto floor_ps = [](__m128 x) {
+            const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+            return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.f)));
+        };
+        const __m128 xy_x = _mm_mul_ps(_mm_sub_ps(u, floor_ps(u)), _mm_set1_ps(float(w)));
+        const __m128 xy_y = _mm_mul_ps(_mm_sub_ps(v, floor_ps(v)), _mm_set1_ps(float(h)));
+        __m128i x0 = _mm_cvttps_epi32(xy_x), y0 = _mm_cvttps_epi32(xy_y);
+        const __m128 fx = _mm_sub_ps(xy_x, _mm_cvtepi32_ps(x0)), fy = _mm_sub_ps(xy_y, _mm_cvtepi32_ps(y0));
+        // wrap coordinates and flag the last column / row
+        const __m128i wi = _mm_set1_epi32(int32_t(w)), hi = _mm_set1_epi32(int32_t(h));
+        const __m128i w1 = _mm_set1_epi32(int32_t(w) - 1), h1 = _mm_set1_epi32(int32_t(h) - 1);
+        x0 = _mm_sub_epi32(x0, _mm_and_si128(_mm_cmpgt_epi32(x0, w1), wi));
+        y0 = _mm_sub_epi32(y0, _mm_and_si128(_mm_cmpgt_epi32(y0, h1), hi));
+        const __m128i last_x = _mm_cmpeq_epi32(x0, w1), last_y = _mm_cmpeq_epi32(y0, h1);
+        alignas(16) int32_t xs[4], ys[4], lx[4], ly[4];
+        alignas(16) float fxs[4], fys[4];
+        _mm_store_si128((__m128i*)xs, x0);
+        _mm_store_si128((__m128i*)ys, y0);
+        _mm_store_si128((__m128i*)lx, last_x);
+        _mm_store_si128((__m128i*)ly, last_y);
+        _mm_store_ps(fxs, fx);
+        _mm_store_ps(fys, fy);
+        for (int k = 0; k < 4; ++k) {
+            if (STATS) TextureStats::record(this, 0, 4);
+            const ptrdiff_t dx = lx[k] ? 1 - ptrdiff_t(w) : 1;
+            const ptrdiff_t dy = ly[k] ? -ptrdiff_t(w) * ptrdiff_t(h - 1) : ptrdiff_t(w);
+            result[k] = footprint(size_t(ys[k]) * w + xs[k], dx, dy, glm::vec2(fxs[k], fys[k]));
+        }
+        return;
+    }
+#endif
+    for (int k = 0; k < 4; ++k)
+        result[k] = bilin(uv[k]);
 }
 
 glm::vec3 Texture::env(const glm::vec3& dir) const {
@@ -95,3 +387,32 @@ glm::vec3 Texture::env(const glm::vec3& dir) const {
     assert(std::isfinite(v));
     return bilin(glm::vec2(u, v));
 }
+
+glm::vec3 Texture::trilin(const glm::vec2& uv, float lod) const {
+    if (mips.empty() || !(lod > 0.f)) return bilin(uv);
+    STAT("Texture lookup");
+    lod = fminf(lod, float(mips.size()));
+    const size_t l = size_t(lod);
+    const float f = lod - l;
+    if (STATS) TextureStats::record(this, l, f > 0.f ? 8 : 4);
+    const glm::vec3 a = level(l).sample(uv);
+    return f > 0.f ? glm::mix(a, level(l + 1).sample(uv), f) : a;
+}
+
+float Texture::lod(const glm::vec2& dUVdx, const glm::vec2& dUVdy) const {
+    // longer axis of the footprint in texels
+    const glm::vec2 dim(w, h);
+    const float len2 = fmaxf(glm::dot(dUVdx * dim, dUVdx * dim), glm::dot(dUVdy * dim, dUVdy * dim));
+    return .5f * log2f(len2);
+}
+
+glm::vec3 Texture::env(const glm::vec3& dir, float lod) const {
+    const float u = atan2f(dir.z, dir.x) / (2.f * M_PI);
+    const float v = acosf(dir.y) / M_PI;
+    assert(std::isfinite(u));
+    assert(std::isfinite(v));
+    return trilin(glm::vec2(u, v), lod);
+}
+
+// print the error of the compact HDR storage formats against float storage for the given texture
+void debug_texture_formats(const Texture& tex);
@@ -0,0 +1,129 @@
+#include "texture_file.h"
+#include "texture.h"
+#include "mapped_file.h"
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+
+static constexpr uint32_t TEXTURE_FILE_VERSION = 1;
+static constexpr size_t TEXTURE_FILE_ALIGN = 64;
+
+struct TextureFileHeader {
+    char magic[8];          // "GITEX\0\0\0"
+    uint32_t version;
+    uint32_t format;        // Texture::Format
+    uint32_t levels;
+    uint32_t flags;         // 1: source had alpha, 2: 8 bit texels are sRGB encoded
+    // followed by: levels x (w, h) uint32 pairs, then the texels of each level (aligned)
+};
+
+inline size_t align_up(size_t offset) {
+    return (offset + TEXTURE_FILE_ALIGN - 1) / TEXTURE_FILE_ALIGN * TEXTURE_FILE_ALIGN;
+}
+
+// -------------------------------------------
+// TextureFile
+
+bool TextureFile::write(const Texture& tex, const std::filesystem::path& path) {
+    if (!tex || tex.is_paged()) return false;
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    // write to a temporary file and rename, so concurrent readers never see partial files
+    const std::filesystem::path tmp = path.string() + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if (!out) {
+            std::cerr << "Warning: TextureFile: unable to write: " << tmp << std::endl;
+            return false;
+        }
+        TextureFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "GITEX", 5);
+        header.version = TEXTURE_FILE_VERSION;
+        header.format = tex.storage_format();
+        header.levels = tex.levels();
+        header.flags = (tex.has_alpha ? 1 : 0) | (tex.lut == Texture::SRGB_LUT ? 2 : 0);
+        out.write((const char*)&header, sizeof(header));
+        for (size_t l = 0; l < tex.levels(); ++l) {
+            const glm::uvec2 d = tex.level(l).dim();
+            out.write((const char*)&d, sizeof(d));
+        }
+        const size_t bpt = Texture::bytes_per_texel(tex.storage_format());
+        size_t offset = sizeof(header) + tex.levels() * sizeof(glm::uvec2);
+        for (size_t l = 0; l < tex.levels(); ++l) {
+            const Texture& level = tex.level(l);
+            static const char zeros[TEXTURE_FILE_ALIGN] = {};
+            out.write(zeros, align_up(offset) - offset);
+            const uint8_t* bytes = level.storage_format() == Texture::RGB32F ? (const uint8_t*)level.data() : level.raw_data();
+            out.write((const char*)bytes, level.width() * level.height() * bpt);
+            offset = align_up(offset) + level.width() * level.height() * bpt;
+        }
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+bool TextureFile::read(Texture& tex, const std::filesystem::path& path) {
+    auto file = std::make_shared<MappedFile>(path, true);
+    if (!*file || file->size() < sizeof(TextureFileHeader)) return false;
+    TextureFileHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, "GITEX", 5) != 0 || header.version != TEXTURE_FILE_VERSION ||
+            header.format > Texture::RGB9E5 || header.levels == 0 || header.levels > 32)
+        return false;
+    const Texture::Format format = Texture::Format(header.format);
+    const size_t bpt = Texture::bytes_per_texel(format);
+    size_t offset = sizeof(header) + header.levels * sizeof(glm::uvec2);
+    if (file->size() < offset) return false;
+    std::vector<glm::uvec2> dims(header.levels);
+    memcpy(dims.data(), file->data() + sizeof(header), dims.size() * sizeof(glm::uvec2));
+    std::vector<size_t> offsets(header.levels);
+    for (uint32_t l = 0; l < header.levels; ++l) {
+        if (dims[l].x == 0 || dims[l].y == 0) return false;
+        offsets[l] = align_up(offset);
+        offset = offsets[l] + size_t(dims[l].x) * dims[l].y * bpt;
+    }
+    if (file->size() < offset) return false;
+    // refer to the mapping instead of holding texels
+    tex.mips.clear();
+    tex.mips.resize(header.levels - 1);
+    for (uint32_t l = 0; l < header.levels; ++l) {
+        Texture& level = l == 0 ? tex : tex.mips[l - 1];
+        std::vector<glm::vec3>().swap(level.texels);
+        std::vector<uint8_t>().swap(level.raw);
+        level.w = dims[l].x;
+        level.h = dims[l].y;
+        level.format = format;
+        level.lut = header.flags & 2 ? Texture::SRGB_LUT : Texture::LINEAR_LUT;
+        level.has_alpha = header.flags & 1;
+        level.src_path = tex.src_path;
+        level.paged.reset();
+        level.mapped = file;
+        level.mapped_offset = offsets[l];
+    }
+    return true;
+}
+
+std::filesystem::path TextureFile::cache_path(const std::filesystem::path& src, bool sRGB) {
+    std::error_code ec;
+    const std::filesystem::path dir = DIR.empty() ? std::filesystem::temp_directory_path(ec) / "gi_texture_cache" : std::filesystem::path(DIR);
+    const std::filesystem::path canonical = std::filesystem::weakly_canonical(src, ec);
+    const auto mtime = std::filesystem::last_write_time(src, ec).time_since_epoch().count();
+    const auto size = std::filesystem::file_size(src, ec);
+    // the stored layout depends on the storage settings as well
+    const std::string settings = std::to_string(Texture::MIPMAPS) + std::to_string(Texture::COMPACT_LDR) + Texture::format_name(Texture::HDR_FORMAT);
+    const size_t hash = std::hash<std::string>()(canonical.string() + "|" + std::to_string(mtime) + "|" + std::to_string(size) + "|" +
+            std::to_string(sRGB) + "|" + settings + "|" + std::to_string(TEXTURE_FILE_VERSION));
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.gitex", (unsigned long long)hash);
+    return dir / name;
+}
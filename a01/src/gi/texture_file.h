@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <filesystem>
+
+class Texture;
+
+/**
+ * @brief Preconverted texture files holding all mip levels in their final storage format, mapped instead of decoded
+ * @note Each level is stored row-major in the in-memory layout of Texture (64 byte aligned), s.t. lookups read directly
+ * from the read-only mapping. Concurrent render processes on the same host share the pages via the page cache.
+ */
+class TextureFile {
+public:
+    /**
+     * @brief Write a texture including its mip levels, atomically via a temporary file
+     *
+     * @param tex Texture with resident (or mapped) texels, paged textures are not supported
+     * @param path Output path
+     *
+     * @return true on success, false otherwise
+     */
+    static bool write(const Texture& tex, const std::filesystem::path& path);
+
+    /**
+     * @brief Map a preconverted file into the given texture (and its mip levels)
+     *
+     * @param tex Texture to set up, left untouched on failure
+     * @param path Path to the preconverted file
+     *
+     * @return true on success, false if the file is missing or invalid
+     */
+    static bool read(Texture& tex, const std::filesystem::path& path);
+
+    /**
+     * @brief Location of the preconverted version of a source image in the cache directory
+     * @note Keyed by path, modification time, file size, the sRGB conversion flag and the texture storage settings.
+     */
+    static std::filesystem::path cache_path(const std::filesystem::path& src, bool sRGB);
+
+    // settings
+    inline static bool ENABLED = true;          ///< Map preconverted files when loading textures, convert on a miss
+    inline static std::string DIR = "";         ///< Directory for preconverted files (empty: system temp directory)
+};
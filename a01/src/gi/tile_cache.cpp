@@ -0,0 +1,193 @@
+#include "tile_cache.h"
+#include "texture.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+static constexpr uint32_t TILED_IMAGE_VERSION = 1;
+
+struct TiledImageHeader {
+    char magic[8];          // "GITILES\0"
+    uint32_t version;
+    uint32_t levels;
+    uint32_t tile;
+    uint32_t alpha;
+    // followed by: levels x (w, h) uint32 pairs, then the tiles of all levels
+};
+
+// -------------------------------------------
+// TiledImage
+
+TiledImage::~TiledImage() {
+    if (page_table) TileCache::instance().release(*this);
+    if (fd >= 0) close(fd);
+}
+
+std::shared_ptr<TiledImage> TiledImage::open(const std::filesystem::path& path) {
+    static std::atomic<uint32_t> next_id{1};
+    std::shared_ptr<TiledImage> image(new TiledImage());
+    image->fd = ::open(path.c_str(), O_RDONLY);
+    if (image->fd < 0) return nullptr;
+    TiledImageHeader header;
+    if (pread(image->fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, "GITILES", 8) != 0 ||
+            header.version != TILED_IMAGE_VERSION || header.tile != TILE || header.levels == 0 || header.levels > 32)
+        return nullptr;
+    std::vector<glm::uvec2> dims(header.levels);
+    if (pread(image->fd, dims.data(), dims.size() * sizeof(glm::uvec2), sizeof(header)) != ssize_t(dims.size() * sizeof(glm::uvec2)))
+        return nullptr;
+    for (const glm::uvec2& d : dims) {
+        if (d.x == 0 || d.y == 0) return nullptr;
+        const uint32_t tiles_x = (d.x + TILE - 1) / TILE, tiles_y = (d.y + TILE - 1) / TILE;
+        image->levels.push_back(Level{ d.x, d.y, tiles_x, image->num_tiles });
+        image->num_tiles += tiles_x * tiles_y;
+    }
+    image->data_offset = sizeof(header) + dims.size() * sizeof(glm::uvec2);
+    std::error_code ec;
+    if (std::filesystem::file_size(path, ec) < image->data_offset + image->num_tiles * TILE_BYTES || ec)
+        return nullptr;
+    image->alpha = header.alpha != 0;
+    image->id = next_id++;
+    image->page_table.reset(new std::atomic<uint32_t>[image->num_tiles]);
+    for (uint32_t i = 0; i < image->num_tiles; ++i)
+        image->page_table[i].store(0, std::memory_order_relaxed);
+    return image;
+}
+
+bool TiledImage::write(const Texture& tex, const std::filesystem::path& path) {
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    // write to a temporary file and rename, so concurrent readers never see partial files
+    const std::filesystem::path tmp = path.string() + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if (!out) {
+            std::cerr << "Warning: TiledImage: unable to write: " << tmp << std::endl;
+            return false;
+        }
+        TiledImageHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "GITILES", 8);
+        header.version = TILED_IMAGE_VERSION;
+        header.levels = tex.levels();
+        header.tile = TILE;
+        header.alpha = tex.has_alpha ? 1 : 0;
+        out.write((const char*)&header, sizeof(header));
+        for (size_t l = 0; l < tex.levels(); ++l) {
+            const glm::uvec2 d = tex.level(l).dim();
+            out.write((const char*)&d, sizeof(d));
+        }
+        // tiles in row-major order per level, border tiles padded by clamping
+        for (size_t l = 0; l < tex.levels(); ++l) {
+            const Texture& level = tex.level(l);
+            const uint32_t tiles_x = (level.w + TILE - 1) / TILE, tiles_y = (level.h + TILE - 1) / TILE;
+            std::vector<glm::vec3> buf(size_t(tiles_x) * tiles_y * TILE * TILE);
+            #pragma omp parallel for
+            for (int ty = 0; ty < int(tiles_y); ++ty)
+                for (uint32_t tx = 0; tx < tiles_x; ++tx)
+                    for (uint32_t y = 0; y < TILE; ++y)
+                        for (uint32_t x = 0; x < TILE; ++x) {
+                            const size_t sx = std::min<size_t>(tx * TILE + x, level.w - 1);
+                            const size_t sy = std::min<size_t>(ty * TILE + y, level.h - 1);
+                            buf[((size_t(ty) * tiles_x + tx) * TILE + y) * TILE + x] = level.fetch(glm::uvec2(sx, sy));
+                        }
+            out.write((const char*)buf.data(), buf.size() * sizeof(glm::vec3));
+        }
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+std::filesystem::path TiledImage::cache_path(const std::filesystem::path& src, bool sRGB) {
+    std::error_code ec;
+    const std::filesystem::path dir = TileCache::DIR.empty() ? std::filesystem::temp_directory_path(ec) / "gi_texture_cache" : std::filesystem::path(TileCache::DIR);
+    const std::filesystem::path canonical = std::filesystem::weakly_canonical(src, ec);
+    const auto mtime = std::filesystem::last_write_time(src, ec).time_since_epoch().count();
+    const auto size = std::filesystem::file_size(src, ec);
+    const size_t hash = std::hash<std::string>()(canonical.string() + "|" + std::to_string(mtime) + "|" +
+            std::to_string(size) + "|" + std::to_string(sRGB) + "|" + std::to_string(TILED_IMAGE_VERSION));
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.tiles", (unsigned long long)hash);
+    return dir / name;
+}
+
+// -------------------------------------------
+// TileCache
+
+TileCache& TileCache::instance() {
+    static TileCache cache;
+    return cache;
+}
+
+TileCache::TileCache() : num_slots(0), hand(0), misses(0), evicted(0) {
+    max_slots = std::max<size_t>(64, BUDGET_MB * (size_t(1) << 20) / TiledImage::TILE_BYTES);
+    slots.reset(new Slot[max_slots]);
+    memory.reserve(max_slots);
+}
+
+void TileCache::page_in(TiledImage& image, uint32_t tile) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint64_t tag = (uint64_t(image.id) << 32) | tile;
+    const uint32_t resident = image.page_table[tile].load(std::memory_order_relaxed);
+    if (resident != 0 && slots[resident - 1].owner.load(std::memory_order_relaxed) == tag)
+        return; // paged in by another thread meanwhile
+    // allocate a new slot while within budget, otherwise evict via clock sweep
+    size_t s;
+    if (num_slots.load(std::memory_order_relaxed) < max_slots) {
+        s = num_slots.load(std::memory_order_relaxed);
+        memory.emplace_back(new uint8_t[TiledImage::TILE_BYTES]);
+        slots[s].data = memory.back().get();
+        num_slots.store(s + 1, std::memory_order_relaxed);
+    } else {
+        for (;;) {
+            Slot& candidate = slots[hand];
+            const size_t current = hand;
+            hand = (hand + 1) % max_slots;
+            if (candidate.referenced.exchange(false, std::memory_order_relaxed)) continue;
+            s = current;
+            break;
+        }
+    }
+    Slot& slot = slots[s];
+    // invalidate the previous owner, readers notice the odd sequence
+    slot.seq.fetch_add(1, std::memory_order_acq_rel);
+    if (slot.image) {
+        slot.image->page_table[uint32_t(slot.owner.load(std::memory_order_relaxed))].store(0, std::memory_order_relaxed);
+        evicted.fetch_add(1, std::memory_order_relaxed);
+    }
+    slot.owner.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    const off_t offset = image.data_offset + uint64_t(tile) * TiledImage::TILE_BYTES;
+    if (pread(image.fd, slot.data, TiledImage::TILE_BYTES, offset) != ssize_t(TiledImage::TILE_BYTES))
+        memset(slot.data, 0, TiledImage::TILE_BYTES);
+    slot.image = &image;
+    slot.owner.store(tag, std::memory_order_relaxed);
+    slot.referenced.store(true, std::memory_order_relaxed);
+    slot.seq.fetch_add(1, std::memory_order_release);
+    image.page_table[tile].store(uint32_t(s + 1), std::memory_order_release);
+    misses.fetch_add(1, std::memory_order_relaxed);
+    image.misses.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TileCache::release(TiledImage& image) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t s = 0; s < num_slots.load(std::memory_order_relaxed); ++s) {
+        Slot& slot = slots[s];
+        if (slot.image != &image) continue;
+        slot.seq.fetch_add(1, std::memory_order_acq_rel);
+        slot.image = nullptr;
+        slot.owner.store(0, std::memory_order_relaxed);
+        slot.referenced.store(false, std::memory_order_relaxed);
+        slot.seq.fetch_add(1, std::memory_order_release);
+    }
+}
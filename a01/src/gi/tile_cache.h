@@ -0,0 +1,173 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <glm/glm.hpp>
+
+class Texture;
+
+/**
+ * @brief Texture (including its mip chain) stored in tiles on disk, paged in through the global TileCache on first touch
+ * @note Texels are stored as RGB float, each mip level as a grid of TILE x TILE tiles padded at the borders.
+ */
+class TiledImage {
+public:
+    static constexpr uint32_t TILE = 32;                                    ///< Tile edge length in texels
+    static constexpr size_t TILE_BYTES = TILE * TILE * sizeof(glm::vec3);   ///< Size of one tile in bytes
+
+    ~TiledImage();
+
+    TiledImage(const TiledImage&)            = delete;
+    TiledImage& operator=(const TiledImage&) = delete;
+
+    /**
+     * @brief Open a tiled file for demand paging
+     *
+     * @param path Path to the tiled file
+     *
+     * @return Tiled image, nullptr if the file is missing or invalid
+     */
+    static std::shared_ptr<TiledImage> open(const std::filesystem::path& path);
+
+    /**
+     * @brief Convert a (mip mapped) texture into a tiled file, written atomically via a temporary file
+     *
+     * @param tex Texture with texels (and mip levels) in memory
+     * @param path Output path
+     *
+     * @return true on success, false otherwise
+     */
+    static bool write(const Texture& tex, const std::filesystem::path& path);
+
+    /**
+     * @brief Location of the tiled version of a source image in the cache directory
+     * @note Keyed by path, modification time, file size and the sRGB conversion flag.
+     */
+    static std::filesystem::path cache_path(const std::filesystem::path& src, bool sRGB);
+
+    // texel lookup, paging in the tile if not resident
+    inline glm::vec3 fetch(uint32_t level, uint32_t x, uint32_t y);
+
+    inline uint32_t num_levels() const { return levels.size(); }
+    inline glm::uvec2 dim(uint32_t level) const { return glm::uvec2(levels[level].w, levels[level].h); }
+    inline bool has_alpha() const { return alpha; }
+    inline size_t nbytes() const { return num_tiles * sizeof(std::atomic<uint32_t>) + levels.size() * sizeof(Level); }
+    inline uint64_t page_ins() const { return misses.load(std::memory_order_relaxed); }
+
+private:
+    friend class TileCache;
+
+    struct Level {
+        uint32_t w, h;          ///< Level dimensions
+        uint32_t tiles_x;       ///< Tiles per row
+        uint32_t first_tile;    ///< Index of the level's first tile
+    };
+
+    TiledImage() : fd(-1), id(0), num_tiles(0), alpha(false) {}
+
+    // data
+    int fd;                                                 ///< File descriptor of the tiled file
+    uint32_t id;                                            ///< Unique id, tags tiles in the TileCache
+    uint32_t num_tiles;                                     ///< Total number of tiles over all levels
+    bool alpha;                                             ///< Source image had an alpha channel
+    uint64_t data_offset;                                   ///< File offset of the first tile
+    std::vector<Level> levels;                              ///< Mip levels
+    std::unique_ptr<std::atomic<uint32_t>[]> page_table;    ///< Resident slot + 1 per tile, 0 if not resident
+    std::atomic<uint64_t> misses{0};                        ///< Number of page-ins of this image's tiles
+};
+
+/**
+ * @brief Global pool of texture tiles with a memory budget and approximate LRU (clock) replacement
+ * @note Lookups of resident tiles are lock-free: each slot carries a sequence counter (odd while being replaced),
+ * readers validate it around their read. Only page-ins take the lock. Slot memory is allocated on demand,
+ * thus memory grows with the tiles actually touched, up to the budget.
+ */
+class TileCache {
+public:
+    static TileCache& instance();
+
+    /**
+     * @brief Fetch a texel, paging in its tile if needed
+     *
+     * @param image Tiled image
+     * @param tile Tile index within the image
+     * @param texel Texel index within the tile
+     *
+     * @return Texel value
+     */
+    inline glm::vec3 fetch(TiledImage& image, uint32_t tile, uint32_t texel);
+
+    // drop all tiles of an image (called on destruction)
+    void release(TiledImage& image);
+
+    // statistics
+    inline size_t nbytes() const { return num_slots.load(std::memory_order_relaxed) * TiledImage::TILE_BYTES; }
+    inline uint64_t page_ins() const { return misses.load(std::memory_order_relaxed); }
+    inline uint64_t evictions() const { return evicted.load(std::memory_order_relaxed); }
+
+    // settings
+    inline static bool ENABLED = false;         ///< Load textures from disk as demand-paged tiled images (opt-in)
+    inline static size_t BUDGET_MB = 1024;      ///< Memory budget for resident tiles (read on first use)
+    inline static std::string DIR = "";         ///< Directory for tiled files (empty: system temp directory)
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq{0};           ///< Sequence counter, odd while the slot is being replaced
+        std::atomic<uint64_t> owner{0};         ///< Image id << 32 | tile index of the resident tile
+        std::atomic<bool> referenced{false};    ///< Clock bit, set on access
+        TiledImage* image = nullptr;            ///< Image owning the resident tile
+        uint8_t* data = nullptr;                ///< Tile memory
+    };
+
+    TileCache();
+
+    // load a tile into a (free or evicted) slot
+    void page_in(TiledImage& image, uint32_t tile);
+
+    // data
+    std::mutex mutex;                                   ///< Guards page-ins and evictions
+    size_t max_slots;                                   ///< Slot capacity according to the budget
+    std::unique_ptr<Slot[]> slots;                      ///< Slots, the first num_slots of which are allocated
+    std::vector<std::unique_ptr<uint8_t[]>> memory;     ///< Tile memory per allocated slot
+    std::atomic<size_t> num_slots;                      ///< Number of allocated slots
+    size_t hand;                                        ///< Clock hand
+    std::atomic<uint64_t> misses;                       ///< Number of page-ins
+    std::atomic<uint64_t> evicted;                      ///< Number of evicted tiles
+};
+
+// --------------------------------------
+// inline implementations
+
+glm::vec3 TiledImage::fetch(uint32_t level, uint32_t x, uint32_t y) {
+    const Level& l = levels[level];
+    const uint32_t tile = l.first_tile + (y / TILE) * l.tiles_x + x / TILE;
+    return TileCache::instance().fetch(*this, tile, (y % TILE) * TILE + x % TILE);
+}
+
+glm::vec3 TileCache::fetch(TiledImage& image, uint32_t tile, uint32_t texel) {
+    const uint64_t tag = (uint64_t(image.id) << 32) | tile;
+    for (;;) {
+        const uint32_t s = image.page_table[tile].load(std::memory_order_acquire);
+        if (s != 0) {
+            Slot& slot = slots[s - 1];
+            const uint32_t seq = slot.seq.load(std::memory_order_acquire);
+            if (!(seq & 1) && slot.owner.load(std::memory_order_relaxed) == tag) {
+                glm::vec3 texel_value;
+                std::memcpy(&texel_value, slot.data + texel * sizeof(glm::vec3), sizeof(glm::vec3));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) == seq) {
+                    if (!slot.referenced.load(std::memory_order_relaxed))
+                        slot.referenced.store(true, std::memory_order_relaxed);
+                    return texel_value;
+                }
+            }
+        }
+        page_in(image, tile);
+    }
+}